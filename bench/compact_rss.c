@@ -0,0 +1,122 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#   include <unistd.h>
+#endif
+
+// Allocates N small guards of each kind and reports what one of
+// them costs: slab bytes per guard (headers, inline payloads and
+// trackers), resident memory per guard where the platform tells,
+// and how many guards fit a 64-byte cache line.
+//
+// usage: compact_rss [N]
+DEFINE_HEAP_GUARD(long, full, 65536);
+DEFINE_HEAP_GUARD_COMPACT(long, compact, 65536);
+
+#define DEFAULT_GUARDS 1000000
+
+static size_t resident_bytes()
+{
+#ifdef __linux__
+    FILE *statm = fopen("/proc/self/statm", "r");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%zu %zu", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *kind, const size_t guards, const size_t footprint, const size_t resident)
+{
+    const double per_guard = (double)footprint / (double)guards;
+    printf("%-8s %10zu guards %8.1f B/guard", kind, guards, per_guard);
+    if (resident != 0)
+    {
+        printf(" %8.1f B/guard resident", (double)resident / (double)guards);
+    }
+    printf(" %5.2f guards/line\n", 64.0 / per_guard);
+}
+
+int main(const int argc, char **argv)
+{
+    const size_t guards = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_GUARDS;
+    void **slots = (void **)calloc(guards, sizeof(void *));
+    if (guards == 0 || slots == NULL)
+    {
+        fprintf(stderr, "usage: %s [N > 0]\n", argv[0]);
+        return 1;
+    }
+
+    printf("header   %zu bytes full, %zu bytes compact\n", sizeof(heap_guard_full_t), sizeof(heap_guard_compact_t));
+
+    size_t before = resident_bytes();
+    for (size_t i = 0; i < guards; i++)
+    {
+        heap_guard_full_t *guard = heap_full_alloc(0, 0, NULL, NULL);
+        if (guard == NULL)
+        {
+            fprintf(stderr, "full guard %zu: out of memory\n", i);
+            return 1;
+        }
+
+        *guard->ptr = (long)i;
+        slots[i] = guard;
+    }
+    size_t after = resident_bytes();
+    report("full", guards, heap_full_footprint(), after > before ? after - before : 0);
+
+    for (size_t i = 0; i < guards; i++)
+    {
+        heap_guard_full_t *guard = (heap_guard_full_t *)slots[i];
+        lower_guard_full(&guard, 0);
+    }
+    heap_full_trim();
+
+    before = resident_bytes();
+    for (size_t i = 0; i < guards; i++)
+    {
+        heap_guard_compact_t *guard = heap_compact_alloc(0, 0, NULL);
+        if (guard == NULL)
+        {
+            fprintf(stderr, "compact guard %zu: out of memory\n", i);
+            return 1;
+        }
+
+        *guard->ptr = (long)i;
+        slots[i] = guard;
+    }
+    after = resident_bytes();
+    report("compact", guards, heap_compact_footprint(), after > before ? after - before : 0);
+
+    for (size_t i = 0; i < guards; i++)
+    {
+        heap_guard_compact_t *guard = (heap_guard_compact_t *)slots[i];
+        lower_guard_compact(&guard, 0);
+    }
+    heap_compact_trim();
+
+    free(slots);
+    return 0;
+}
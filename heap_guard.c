@@ -8,4 +8,6 @@
  * under certain conditions; type show c' for details.
 */
 
+// Defines the process-wide state declared in the header
+#define HEAP_GUARD_IMPLEMENTATION
 #include "heap_guard.h"
@@ -11,6 +11,14 @@
 #ifndef FLUENT_LIBC_HEAP_GUARD_H
 #define FLUENT_LIBC_HEAP_GUARD_H
 
+// POSIX mapping and file APIs are hidden under strict -std=c11,
+// memfd_create() additionally needs the GNU extensions
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#elif !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
 // ============= FLUENT LIB C =============
 // heap_guard_t API
 // ----------------------------------------
@@ -34,10 +42,165 @@
 // heap_guard_t *heap_alloc(size_t size, int is_concurrent);
 // void raise_guard(heap_guard_t *guard);
 // void lower_guard(heap_guard_t **guard_ptr);
-// int  extend_guard(heap_guard_t *guard, size_t size);
+// int  extend_guard(heap_guard_t *guard, size_t count, int insertion_concurrent);
 // void drop_guard(heap_guard_t **guard_ptr);
+// heap_guard_t *share_guard(heap_guard_t *guard); // promotes to atomic counts,
+//                                                 // raised for the receiver
+// void heap_make_immortal(heap_guard_t *guard); // raise/lower become read-only
+// void lock_guard(heap_guard_t *guard);    // embedded spin-then-park lock
+// int  trylock_guard(heap_guard_t *guard); // 1 when taken
+// void unlock_guard(heap_guard_t *guard);
+//
+// Seqlocked payloads (small, read-mostly; writers only through these):
+// void read_guard(heap_guard_t *guard, V *copy_out); // lock-free, retries
+// void write_guard(heap_guard_t *guard, const V *value);
+// void write_begin_guard(heap_guard_t *guard); // update guard->ptr in between
+// void write_end_guard(heap_guard_t *guard);
+//
+// Reader-biased rwlock (DEFINE_HEAP_GUARD_RW(V, NAME, ARENA_SIZE),
+// writers also exclude lock_guard):
+// size_t rdlock_guard(heap_guard_t *guard); // token for rdunlock
+// void   rdunlock_guard(heap_guard_t *guard, size_t token);
+// void   wrlock_guard(heap_guard_t *guard);
+// void   wrunlock_guard(heap_guard_t *guard);
+//
+// Payload replacement (POSIX, readers inside heap_guard_epoch_enter/exit):
+// V   *deref_guard(heap_guard_t *guard, size_t *count); // consistent ptr/length
+// int  replace_payload(heap_guard_t *guard, V *new_ptr, size_t count,
+//                      const heap_guard_releaser_t *releaser, // NULL: not owned
+//                      int insertion_concurrent);
+// int  extend_guard_rcu(heap_guard_t *guard, size_t count, int insertion_concurrent);
 // void heap_destroy(void);
 //
+// Array payloads (mapped directly from HEAP_GUARD_LARGE_THRESHOLD bytes):
+// heap_guard_t *heap_alloc_array(size_t count, int is_concurrent,
+//                                int insertion_concurrent, destructor);
+//
+// Adopted buffers (released through `releaser` on the final lower):
+// heap_guard_t *heap_adopt(V *ptr, size_t count, const heap_guard_releaser_t *releaser,
+//                          int is_concurrent, int insertion_concurrent, destructor);
+// const heap_guard_releaser_t *heap_guard_releaser_free(void);
+// const heap_guard_releaser_t *heap_guard_releaser_munmap(void); // POSIX
+//
+// Fault injection (HEAP_GUARD_FAULT_INJECTION builds only):
+// void   heap_guard_fault_inject(size_t sites, size_t every);
+// void   heap_guard_fault_clear(void);
+// size_t heap_guard_fault_hits(void);
+//
+// Snapshots (POSIX, every DEFINE_HEAP_GUARD type):
+// long heap_snapshot_write(int fd);
+// long heap_snapshot_read(int fd, int insertion_concurrent,
+//                         destructor, callback, void *ctx);
+//      // callback(guard, ctx) owns one reference per restored guard
+//
+// Backing allocators (before the first allocation):
+// int    heap_set_backing(const heap_guard_backing_t *backing);
+// size_t heap_trim(void);      // releases empty blocks
+// size_t heap_footprint(void); // bytes held in blocks
+//
+// Guard caches (DEFINE_HEAP_GUARD_CACHE after DEFINE_HEAP_GUARD):
+// int  guard_cache_init(guard_cache_t *cache, size_t budget,
+//                       size_t capacity, int insertion_concurrent);
+// heap_guard_t *guard_cache_get(guard_cache_t *cache, uint64_t key);
+// int  guard_cache_put(guard_cache_t *cache, uint64_t key, heap_guard_t *guard);
+// int  guard_cache_remove(guard_cache_t *cache, uint64_t key);
+// size_t guard_cache_evict(guard_cache_t *cache, size_t bytes);
+// size_t guard_cache_reclaim(size_t needed, void *ctx); // heap_guard_reclaim_t
+// void guard_cache_destroy(guard_cache_t *cache);
+//
+// Epochs (POSIX):
+// void heap_guard_epoch_enter(void);
+// void heap_guard_epoch_exit(void);
+// void heap_guard_epoch_retire(heap_guard_retired_t *retired, reclaim);
+// void heap_guard_epoch_synchronize(void);
+//
+// Guard maps (POSIX, DEFINE_HEAP_GUARD_MAP after DEFINE_HEAP_GUARD):
+// int  guard_map_init(guard_map_t *map, size_t capacity, int insertion_concurrent);
+// heap_guard_t *guard_map_get(guard_map_t *map, uint64_t key); // raised
+// int  guard_map_insert(guard_map_t *map, uint64_t key, heap_guard_t *guard);
+// int  guard_map_remove(guard_map_t *map, uint64_t key);
+// void guard_map_destroy(guard_map_t *map);
+//
+// Guard queues (POSIX, DEFINE_HEAP_GUARD_QUEUE after DEFINE_HEAP_GUARD):
+// int    guard_queue_init(guard_queue_t *queue, size_t capacity, int insertion_concurrent);
+// int    guard_queue_push(guard_queue_t *queue, heap_guard_t *guard); // takes the reference
+// heap_guard_t *guard_queue_pop(guard_queue_t *queue);               // hands it over
+// size_t guard_queue_push_batch(guard_queue_t *queue, heap_guard_t **guards, size_t count);
+// size_t guard_queue_pop_batch(guard_queue_t *queue, heap_guard_t **out, size_t max);
+// void   guard_queue_destroy(guard_queue_t *queue);
+//
+// I/O buffers (DEFINE_HEAP_GUARD_BUFFERS(NAME, BUFFER_SIZE, ARENA_SIZE),
+// page-aligned, BUFFER_SIZE a multiple of 4096):
+// int    heap_reserve_buffers(size_t count, int insertion_concurrent); // POSIX
+// size_t heap_iovec(heap_guard_t *const *guards, const size_t *lengths,
+//                   size_t count, struct iovec *out);                 // POSIX
+// int    heap_register_io_uring(int ring_fd);   // Linux, pins reserved blocks
+// int    heap_fixed_index(const heap_guard_t *guard); // buf_index or -1
+// int    heap_unregister_io_uring(int ring_fd);
+//
+// Slices (zero-copy views into a guard's payload, in elements):
+// int  slice_guard(heap_guard_t *guard, size_t offset, size_t length,
+//                  heap_slice_t *out); // raises the parent once
+// int  subslice(const heap_slice_t *slice, size_t offset, size_t length,
+//               heap_slice_t *out);
+// V   *heap_slice_data(const heap_slice_t *slice);
+// void release_slice(heap_slice_t *slice, int insertion_concurrent);
+//
+// Memory limits (every DEFINE_HEAP_GUARD type):
+// void   heap_set_limit(size_t bytes, int policy, long timeout_ms);
+// void   heap_set_reclaim(heap_guard_reclaim_t reclaim, void *ctx);
+// size_t heap_usage(void); // bytes charged to live guards
+//
+// jemalloc arenas (HAVE_JEMALLOC, before the first allocation):
+// int  heap_use_jemalloc_arena(int tcache);
+// int  heap_jemalloc_decay(ssize_t dirty_ms, ssize_t muzzy_ms);
+// int  heap_jemalloc_purge(void);
+//
+// Memory pressure (Linux, pools used with insertion_concurrent):
+// int    heap_guard_pressure_start(int source, unsigned stall_us,
+//                                  unsigned window_us);
+// void   heap_guard_pressure_stop(void);
+// size_t heap_guard_pressure_events(size_t *released);
+// size_t heap_guard_trim_all(void);
+//
+// Fork handling (POSIX, every DEFINE_HEAP_GUARD type):
+// void heap_set_fork_policy(int policy); // HEAP_GUARD_FORK_KEEP/RESET
+// void heap_fork_reset(void);
+//
+// Persistent heaps (POSIX, DEFINE_HEAP_GUARD_PERSISTENT):
+// int  heap_persist_open(const char *path, size_t capacity);
+// heap_guard_handle_t heap_persist_alloc(void);
+// V   *heap_persist_resolve(heap_guard_handle_t handle);
+// void heap_persist_raise(heap_guard_handle_t handle);
+// void heap_persist_lower(heap_guard_handle_t *handle_ptr);
+// int  heap_persist_sync(int async);
+// void heap_persist_close(void);
+//
+// Shared heaps (POSIX, DEFINE_HEAP_GUARD_SHARED) expose the same
+// handle API with a `shared` infix, created and joined with:
+// int  heap_shared_create(const char *name, size_t capacity);
+// int  heap_shared_open(const char *name);
+// int  heap_shared_attach(int fd);
+//
+// Aligned payloads (ALIGN a power of two, at least _Alignof(V)):
+// DEFINE_HEAP_GUARD_ALIGNED(V, NAME, ARENA_SIZE, ALIGN);
+//
+// Inline payloads: heap_alloc() without default_ptr stores a V of
+// at most HEAP_GUARD_INLINE_MAX bytes inside the guard's own slot,
+// `ptr` pointing right behind the header. Chosen per type at
+// compile time; larger types keep the separate payload slab.
+//
+// Compact guards (DEFINE_HEAP_GUARD_COMPACT(V, NAME, ARENA_SIZE),
+// 16-byte header, one V per guard, no destructors or limits):
+// heap_guard_t *heap_alloc(int is_concurrent, int insertion_concurrent, V *default_ptr);
+// void   raise_guard(heap_guard_t *guard);
+// void   lower_guard(heap_guard_t **guard_ptr, int insertion_concurrent);
+// heap_guard_t *share_guard(heap_guard_t *guard);
+// void   heap_make_immortal(heap_guard_t *guard);
+// size_t heap_ref_count(const heap_guard_t *guard);
+// lock_guard/trylock_guard/unlock_guard, heap_trim and heap_footprint
+// as above.
+//
 // Macro Usage Example:
 // ----------------------------------------
 // // Define a heap guard for int type
@@ -58,10 +221,16 @@
 //     lower_guard_my_int(&guard, 1); // Decrease ref count, auto-free if zero
 // }
 //
+// Process-wide state (the pressure registry, fault injection and
+// epochs) is defined once, by the translation unit that defines
+// HEAP_GUARD_IMPLEMENTATION before including this header. The
+// library's heap_guard.c does; programs that skip the library
+// define it in exactly one of their own files.
+//
 // ----------------------------------------
 // Initial revision: 2025-05-26
 // ----------------------------------------
-// Depends on: mutex.h, optional.h, stdlib.h, jemalloc (optional)
+// Depends on: mutex.h, atomic.h, stdlib.h, jemalloc (optional)
 // ----------------------------------------
 
 // ============= FLUENT LIB C++ =============
@@ -85,367 +254,5812 @@ extern "C"
 #ifndef FLUENT_LIBC_RELEASE
 #   include <mutex.h> // fluent_libc
 #   include <atomic.h> // fluent_libc
-#   include <arena.h> // fluent_libc
-#   include <vector.h> // fluent_libc
 #else
 #   include <fluent/mutex/mutex.h> // fluent_libc
 #   include <fluent/atomic/atomic.h> // fluent_libc
-#   include <fluent/arena/arena.h> // fluent_libc
-#   include <fluent/vector/vector.h> // fluent_libc
 #endif
 
-// ============= MACRO =============
-#define DEFINE_HEAP_GUARD(V, NAME, ARENA_SIZE) \
-    int __fluent_libc_hg_##NAME##_has_put_atexit_guard = 0; \
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifndef _WIN32
+#   include <stdatomic.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <stdio.h>
+#   include <errno.h>
+#   include <limits.h>
+#   include <sys/uio.h>
+#   include <pthread.h>
+#   include <sched.h>
+#   include <time.h>
+#   ifdef __linux__
+#       include <poll.h>
+#       include <sys/eventfd.h>
+#       include <sys/syscall.h>
+#       include <linux/futex.h>
+#   endif
+#else
+#   include <windows.h>
+#endif
+
+// ============= HELPERS =============
+static inline void __fluent_libc_hg_yield()
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// ============= BACKING ALLOCATORS =============
+// Where slab blocks (and the registry mutex) come from. A
+// backing hands out `size` bytes aligned to `align`, takes
+// them back with the same size, and may optionally return
+// cached memory to the system on trim. Any allocator that
+// fits (hugepage mappings, NUMA nodes, fault injection...)
+// can be plugged into a type with heap_NAME_set_backing().
+typedef struct heap_guard_backing_t
+{
+    void *(*block_alloc)(void *ctx, size_t size, size_t align);
+    void (*block_free)(void *ctx, void *block, size_t size);
+    void (*trim)(void *ctx); // optional
+    void *ctx;
+} heap_guard_backing_t;
+
+static inline void *__fluent_libc_hg_malloc_block_alloc(void *ctx, const size_t size, const size_t align)
+{
+    (void)ctx;
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    void *block = NULL;
+    if (posix_memalign(&block, align < sizeof(void *) ? sizeof(void *) : align, size) != 0)
+    {
+        return NULL;
+    }
+
+    return block;
+#endif
+}
+
+static inline void __fluent_libc_hg_malloc_block_free(void *ctx, void *block, const size_t size)
+{
+    (void)ctx;
+    (void)size;
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+static inline void __fluent_libc_hg_malloc_trim(void *ctx)
+{
+    (void)ctx;
+#if defined(__GLIBC__) && !defined(HAVE_JEMALLOC)
+    malloc_trim(0);
+#endif
+}
+
+/**
+ * The default backing: aligned blocks from the process
+ * allocator (jemalloc's when it is linked in).
+ */
+static inline const heap_guard_backing_t *heap_guard_backing_malloc()
+{
+    static const heap_guard_backing_t backing = {
+        __fluent_libc_hg_malloc_block_alloc,
+        __fluent_libc_hg_malloc_block_free,
+        __fluent_libc_hg_malloc_trim,
+        NULL
+    };
+
+    return &backing;
+}
+
+#ifndef _WIN32
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#   define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static inline void *__fluent_libc_hg_mmap_block_alloc(void *ctx, const size_t size, const size_t align)
+{
+    // Over-map, then cut the misaligned head and the tail off
+    const size_t span = size + align;
+    unsigned char *raw = (unsigned char *)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == (unsigned char *)MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    unsigned char *block = (unsigned char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if (block > raw)
+    {
+        munmap(raw, (size_t)(block - raw));
+    }
+
+    if (raw + span > block + size)
+    {
+        munmap(block + size, (size_t)(raw + span - (block + size)));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (ctx != NULL)
+    {
+        madvise(block, size, MADV_HUGEPAGE);
+    }
+#else
+    (void)ctx;
+#endif
+
+    return block;
+}
+
+static inline void __fluent_libc_hg_mmap_block_free(void *ctx, void *block, const size_t size)
+{
+    (void)ctx;
+    munmap(block, size);
+}
+
+/**
+ * Blocks mapped straight from the kernel, unmapped as soon
+ * as they are released.
+ */
+static inline const heap_guard_backing_t *heap_guard_backing_mmap()
+{
+    static const heap_guard_backing_t backing = {
+        __fluent_libc_hg_mmap_block_alloc,
+        __fluent_libc_hg_mmap_block_free,
+        NULL,
+        NULL
+    };
+
+    return &backing;
+}
+
+/**
+ * Same as heap_guard_backing_mmap(), with blocks advised
+ * for transparent hugepages. Only blocks of 2MB or more
+ * benefit, so pick ARENA_SIZE accordingly.
+ */
+static inline const heap_guard_backing_t *heap_guard_backing_hugepages()
+{
+    static const int hugepages = 1;
+    static const heap_guard_backing_t backing = {
+        __fluent_libc_hg_mmap_block_alloc,
+        __fluent_libc_hg_mmap_block_free,
+        NULL,
+        (void *)&hugepages
+    };
+
+    return &backing;
+}
+
+#endif // _WIN32
+
+// ============= FAULT INJECTION =============
+// Compiled in with HEAP_GUARD_FAULT_INJECTION, this makes
+// chosen allocation sites fail on demand so every NULL path
+// of heap_NAME_alloc can be driven, including from several
+// threads at once. Without the flag every check folds to 0.
+// The flag must match in every unit, HEAP_GUARD_IMPLEMENTATION
+// included (HEAP_GUARD_FAULT_INJECTION=ON in CMake).
+#define HEAP_GUARD_FAULT_BLOCK 0x1    // slab block from the backing
+#define HEAP_GUARD_FAULT_GUARD 0x2    // guard slot
+#define HEAP_GUARD_FAULT_PAYLOAD 0x4  // payload slot
+#define HEAP_GUARD_FAULT_TRACKER 0x8  // tracker slot
+#define HEAP_GUARD_FAULT_MUTEX 0x10   // registry mutex
+#define HEAP_GUARD_FAULT_ALL 0x1F
+
+#ifdef HEAP_GUARD_FAULT_INJECTION
+
+typedef struct __fluent_libc_hg_fault_state_t
+{
+    atomic_size_t sites;
+    atomic_size_t every;
+    atomic_size_t calls;
+    atomic_size_t hits;
+} __fluent_libc_hg_fault_state_t;
+
+#ifdef HEAP_GUARD_IMPLEMENTATION
+__fluent_libc_hg_fault_state_t __fluent_libc_hg_faults;
+#else
+extern __fluent_libc_hg_fault_state_t __fluent_libc_hg_faults;
+#endif
+
+static inline __fluent_libc_hg_fault_state_t *__fluent_libc_hg_fault_state()
+{
+    return &__fluent_libc_hg_faults;
+}
+
+/**
+ * Fails every `every`-th check made at any of `sites`,
+ * counted across all threads (1 fails all of them).
+ */
+static inline void heap_guard_fault_inject(const size_t sites, const size_t every)
+{
+    __fluent_libc_hg_fault_state_t *state = __fluent_libc_hg_fault_state();
+    atomic_size_store(&state->sites, 0);
+    atomic_size_store(&state->calls, 0);
+    atomic_size_store(&state->hits, 0);
+    atomic_size_store(&state->every, every);
+    atomic_size_store(&state->sites, sites);
+}
+
+static inline void heap_guard_fault_clear()
+{
+    atomic_size_store(&__fluent_libc_hg_fault_state()->sites, 0);
+}
+
+/**
+ * Returns how many checks were failed since the last call
+ * to heap_guard_fault_inject().
+ */
+static inline size_t heap_guard_fault_hits()
+{
+    return atomic_size_load(&__fluent_libc_hg_fault_state()->hits);
+}
+
+static inline int __fluent_libc_hg_fault(const size_t site)
+{
+    __fluent_libc_hg_fault_state_t *state = __fluent_libc_hg_fault_state();
+    if ((atomic_size_load(&state->sites) & site) == 0)
+    {
+        return 0;
+    }
+
+    const size_t every = atomic_size_load(&state->every);
+    if (every == 0 || (atomic_size_fetch_add(&state->calls, 1) + 1) % every != 0)
+    {
+        return 0;
+    }
+
+    atomic_size_fetch_add(&state->hits, 1);
+    return 1;
+}
+
+#else
+#   define __fluent_libc_hg_fault(site) 0
+#endif // HEAP_GUARD_FAULT_INJECTION
+
+// ============= SLABS =============
+// Fixed-size slot allocator backing every pool. Blocks are
+// aligned to their own (power of two) size so a slot finds
+// its block by masking its address, and each block keeps
+// its own intrusive free list so empty blocks can be spotted
+// and handed back.
+#define HEAP_GUARD_SLAB_MIN_BLOCK 4096
+
+typedef struct __fluent_libc_hg_block_t
+{
+    struct __fluent_libc_hg_block_t *next; // every block of the slab
+    struct __fluent_libc_hg_block_t *next_partial; // blocks with room left
+    struct __fluent_libc_hg_block_t *prev_partial;
+    void *free;
+    size_t bump;
+    size_t live;
+    int partial;
+} __fluent_libc_hg_block_t;
+
+typedef struct __fluent_libc_hg_slab_t
+{
+    size_t slot_size;
+    size_t block_size;
+    size_t data_offset;
+    size_t slots_per_block;
+    size_t block_count;
+    __fluent_libc_hg_block_t *blocks;
+    __fluent_libc_hg_block_t *partial;
+    const heap_guard_backing_t *backing;
+    int pinned; // blocks registered with the kernel, never trimmed
+} __fluent_libc_hg_slab_t;
+
+static inline size_t __fluent_libc_hg_align_up(const size_t value, const size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+/**
+ * Sizes a slab for slots of `slot_size` bytes aligned to
+ * `slot_align`, with room for at least `slots_hint` slots
+ * per block.
+ */
+static inline void __fluent_libc_hg_slab_init(
+    __fluent_libc_hg_slab_t *slab,
+    size_t slot_size,
+    size_t slot_align,
+    const size_t slots_hint
+)
+{
+    // Free slots hold the free-list link
+    if (slot_align < _Alignof(void *))
+    {
+        slot_align = _Alignof(void *);
+    }
+
+    if (slot_size < sizeof(void *))
+    {
+        slot_size = sizeof(void *);
+    }
+
+    slab->slot_size = __fluent_libc_hg_align_up(slot_size, slot_align);
+    slab->data_offset = __fluent_libc_hg_align_up(sizeof(__fluent_libc_hg_block_t), slot_align);
+
+    const size_t wanted = slab->data_offset + (slots_hint ? slots_hint : 1) * slab->slot_size;
+    slab->block_size = HEAP_GUARD_SLAB_MIN_BLOCK;
+    while (slab->block_size < wanted)
+    {
+        slab->block_size <<= 1;
+    }
+
+    // Whatever the rounding left over becomes extra slots
+    slab->slots_per_block = (slab->block_size - slab->data_offset) / slab->slot_size;
+    slab->block_count = 0;
+    slab->blocks = NULL;
+    slab->partial = NULL;
+    slab->pinned = 0;
+
+    if (slab->backing == NULL)
+    {
+        slab->backing = heap_guard_backing_malloc();
+    }
+}
+
+static inline __fluent_libc_hg_block_t *__fluent_libc_hg_slab_block_alloc(const __fluent_libc_hg_slab_t *slab)
+{
+    if (__fluent_libc_hg_fault(HEAP_GUARD_FAULT_BLOCK))
+    {
+        return NULL;
+    }
+
+    return (__fluent_libc_hg_block_t *)slab->backing->block_alloc(slab->backing->ctx, slab->block_size, slab->block_size);
+}
+
+static inline void __fluent_libc_hg_slab_block_free(const __fluent_libc_hg_slab_t *slab, __fluent_libc_hg_block_t *block)
+{
+    slab->backing->block_free(slab->backing->ctx, block, slab->block_size);
+}
+
+static inline void __fluent_libc_hg_slab_unlink_partial(__fluent_libc_hg_slab_t *slab, __fluent_libc_hg_block_t *block)
+{
+    if (block->prev_partial != NULL)
+    {
+        block->prev_partial->next_partial = block->next_partial;
+    }
+    else
+    {
+        slab->partial = block->next_partial;
+    }
+
+    if (block->next_partial != NULL)
+    {
+        block->next_partial->prev_partial = block->prev_partial;
+    }
+
+    block->next_partial = NULL;
+    block->prev_partial = NULL;
+    block->partial = 0;
+}
+
+static inline void __fluent_libc_hg_slab_link_partial(__fluent_libc_hg_slab_t *slab, __fluent_libc_hg_block_t *block)
+{
+    block->prev_partial = NULL;
+    block->next_partial = slab->partial;
+    if (slab->partial != NULL)
+    {
+        slab->partial->prev_partial = block;
+    }
+
+    slab->partial = block;
+    block->partial = 1;
+}
+
+static inline __fluent_libc_hg_block_t *__fluent_libc_hg_slab_grow(__fluent_libc_hg_slab_t *slab)
+{
+    __fluent_libc_hg_block_t *block = __fluent_libc_hg_slab_block_alloc(slab);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    block->free = NULL;
+    block->bump = 0;
+    block->live = 0;
+    block->next = slab->blocks;
+    slab->blocks = block;
+    slab->block_count++;
+    __fluent_libc_hg_slab_link_partial(slab, block);
+    return block;
+}
+
+/**
+ * Grows the slab until at least `slots` slots are free.
+ * Returns 0, or -1 if the backing ran out first.
+ */
+static inline int __fluent_libc_hg_slab_reserve(__fluent_libc_hg_slab_t *slab, const size_t slots)
+{
+    size_t free_slots = 0;
+    for (const __fluent_libc_hg_block_t *block = slab->blocks; block != NULL; block = block->next)
+    {
+        free_slots += slab->slots_per_block - block->live;
+    }
+
+    while (free_slots < slots)
+    {
+        if (__fluent_libc_hg_slab_grow(slab) == NULL)
+        {
+            return -1;
+        }
+
+        free_slots += slab->slots_per_block;
+    }
+
+    return 0;
+}
+
+static inline void *__fluent_libc_hg_slab_malloc(__fluent_libc_hg_slab_t *slab)
+{
+    __fluent_libc_hg_block_t *block = slab->partial;
+
+    if (block == NULL)
+    {
+        block = __fluent_libc_hg_slab_grow(slab);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    void *slot;
+    if (block->free != NULL)
+    {
+        slot = block->free;
+        block->free = *(void **)slot;
+    }
+    else
+    {
+        slot = (unsigned char *)block + slab->data_offset + block->bump * slab->slot_size;
+        block->bump++;
+    }
+
+    block->live++;
+    if (block->free == NULL && block->bump == slab->slots_per_block)
+    {
+        __fluent_libc_hg_slab_unlink_partial(slab, block);
+    }
+
+    return slot;
+}
+
+static inline void __fluent_libc_hg_slab_free(__fluent_libc_hg_slab_t *slab, void *slot)
+{
+    __fluent_libc_hg_block_t *block = (__fluent_libc_hg_block_t *)((uintptr_t)slot & ~(uintptr_t)(slab->block_size - 1));
+
+    *(void **)slot = block->free;
+    block->free = slot;
+    block->live--;
+
+    if (!block->partial)
+    {
+        __fluent_libc_hg_slab_link_partial(slab, block);
+    }
+}
+
+/**
+ * Hands every block without live slots back to the backing.
+ *
+ * Returns the number of bytes released.
+ */
+static inline size_t __fluent_libc_hg_slab_trim(__fluent_libc_hg_slab_t *slab)
+{
+    size_t released = 0;
+    __fluent_libc_hg_block_t **link = &slab->blocks;
+
+    if (slab->pinned)
+    {
+        return 0;
+    }
+
+    while (*link != NULL)
+    {
+        __fluent_libc_hg_block_t *block = *link;
+        if (block->live != 0)
+        {
+            link = &block->next;
+            continue;
+        }
+
+        *link = block->next;
+        if (block->partial)
+        {
+            __fluent_libc_hg_slab_unlink_partial(slab, block);
+        }
+
+        __fluent_libc_hg_slab_block_free(slab, block);
+        slab->block_count--;
+        released += slab->block_size;
+    }
+
+    return released;
+}
+
+static inline void __fluent_libc_hg_slab_destroy(__fluent_libc_hg_slab_t *slab)
+{
+    __fluent_libc_hg_block_t *block = slab->blocks;
+    while (block != NULL)
+    {
+        __fluent_libc_hg_block_t *next = block->next;
+        __fluent_libc_hg_slab_block_free(slab, block);
+        block = next;
+    }
+
+    slab->blocks = NULL;
+    slab->partial = NULL;
+    slab->block_count = 0;
+}
+
+// ============= JEMALLOC ARENAS =============
+// With jemalloc available a type can move its slab blocks to
+// an arena of its own: blocks of different types never share
+// extents, and freed blocks follow that arena's decay-based
+// purging instead of the global one.
+#ifdef HAVE_JEMALLOC
+
+#define HEAP_GUARD_JEMALLOC_TCACHE_OFF 0 // blocks bypass the thread cache
+#define HEAP_GUARD_JEMALLOC_TCACHE_ON 1  // blocks go through the calling thread's cache
+
+typedef struct heap_guard_jemalloc_backing_t
+{
+    heap_guard_backing_t backing;
+    unsigned arena;
+    int flags;
+} heap_guard_jemalloc_backing_t;
+
+static inline void *__fluent_libc_hg_jemalloc_block_alloc(void *ctx, const size_t size, const size_t align)
+{
+    const heap_guard_jemalloc_backing_t *jemalloc = (const heap_guard_jemalloc_backing_t *)ctx;
+    return mallocx(size, MALLOCX_ALIGN(align) | jemalloc->flags);
+}
+
+static inline void __fluent_libc_hg_jemalloc_block_free(void *ctx, void *block, const size_t size)
+{
+    const heap_guard_jemalloc_backing_t *jemalloc = (const heap_guard_jemalloc_backing_t *)ctx;
+    sdallocx(block, size, jemalloc->flags);
+}
+
+static inline void __fluent_libc_hg_jemalloc_trim(void *ctx)
+{
+    const heap_guard_jemalloc_backing_t *jemalloc = (const heap_guard_jemalloc_backing_t *)ctx;
+
+    char key[64];
+    snprintf(key, sizeof(key), "arena.%u.decay", jemalloc->arena);
+    mallctl(key, NULL, NULL, NULL, 0);
+}
+
+/**
+ * Creates a dedicated jemalloc arena and fills `out` with a
+ * backing that allocates from it. `out` must outlive every
+ * pool using it.
+ */
+static inline int heap_guard_backing_jemalloc(heap_guard_jemalloc_backing_t *out, const int tcache)
+{
+    unsigned arena = 0;
+    size_t arena_size = sizeof(arena);
+    if (mallctl("arenas.create", &arena, &arena_size, NULL, 0) != 0)
+    {
+        return -1;
+    }
+
+    out->arena = arena;
+    out->flags = MALLOCX_ARENA(arena) | (tcache ? 0 : MALLOCX_TCACHE_NONE);
+    out->backing.block_alloc = __fluent_libc_hg_jemalloc_block_alloc;
+    out->backing.block_free = __fluent_libc_hg_jemalloc_block_free;
+    out->backing.trim = __fluent_libc_hg_jemalloc_trim;
+    out->backing.ctx = out;
+    return 0;
+}
+
+#define __FLUENT_LIBC_HG_JEMALLOC_API(V, NAME) \
+    heap_guard_jemalloc_backing_t __fluent_libc_hg_##NAME##_jemalloc; \
                                                             \
-    typedef struct heap_guard_##NAME##_t                    \
+    static inline int heap_##NAME##_use_jemalloc_arena(const int tcache) \
     {                                                       \
-        V *ptr;                                             \
-        size_t allocated;                                   \
-        size_t ref_count;                                   \
-        atomic_size_t concurrent_ref;                       \
-        int concurrent;                                     \
-        void (*destructor)                                  \
-            (const struct heap_guard_##NAME##_t *guard, int is_exit); \
-        void *__tracker;                                    \
-    } heap_guard_##NAME##_t;                                \
+        if (                                                \
+            atomic_size_load(&__fluent_libc_hg_##NAME##_init_state) != 0 || \
+            heap_guard_backing_jemalloc(&__fluent_libc_hg_##NAME##_jemalloc, tcache) != 0 \
+        )                                                   \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
                                                             \
-    typedef void (*heap_##NAME##_destructor_t)(const heap_guard_##NAME##_t *guard, int is_exit); \
+        return heap_##NAME##_set_backing(&__fluent_libc_hg_##NAME##_jemalloc.backing); \
+    }                                                       \
                                                             \
-    typedef struct __fluent_libc_heap_##NAME##_tracker_t    \
+    static inline int heap_##NAME##_jemalloc_decay(         \
+        const ssize_t dirty_decay_ms,                       \
+        const ssize_t muzzy_decay_ms                        \
+    )                                                       \
     {                                                       \
-        heap_guard_##NAME##_t *guard;                       \
-        struct __fluent_libc_heap_##NAME##_tracker_t *next; \
-        struct __fluent_libc_heap_##NAME##_tracker_t *prev; \
-        struct __fluent_libc_heap_##NAME##_tracker_t *tail; \
-    } __fluent_libc_heap_##NAME##_tracker_t;                \
+        if (__fluent_libc_hg_##NAME##_backing != &__fluent_libc_hg_##NAME##_jemalloc.backing) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
                                                             \
-    DEFINE_VECTOR(V *, __fluent_libc_hp_fl_##NAME);       \
-    DEFINE_VECTOR(heap_guard_##NAME##_t *, __fluent_libc_hph_fl_##NAME); \
-    DEFINE_VECTOR(__fluent_libc_heap_##NAME##_tracker_t *, __fluent_libc_hpt_fl_##NAME); \
+        char key[64];                                       \
+        ssize_t dirty = dirty_decay_ms;                     \
+        ssize_t muzzy = muzzy_decay_ms;                     \
                                                             \
-    __fluent_libc_heap_##NAME##_tracker_t *__fluent_libc_impl_heap_##NAME##_guards = NULL; \
-    mutex_t *__fluent_libc_impl_hg_##NAME##_mutex = NULL;   \
+        snprintf(key, sizeof(key), "arena.%u.dirty_decay_ms", __fluent_libc_hg_##NAME##_jemalloc.arena); \
+        if (mallctl(key, NULL, NULL, &dirty, sizeof(dirty)) != 0) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
                                                             \
-    arena_allocator_t *__fluent_libc_hg_##NAME##_arena_allocator = NULL; \
-    arena_allocator_t *__fluent_libc_hg_##NAME##_val_arena_allocator = NULL; \
-    arena_allocator_t *__fluent_libc_hg_heap_##NAME##_arena_allocator = NULL; \
-    vector___fluent_libc_hp_fl_##NAME##_t *__fluent_libc_hg_##NAME##_free_list = NULL; \
-    vector___fluent_libc_hph_fl_##NAME##_t *__fluent_libc_hgh_##NAME##_free_list = NULL; \
-    vector___fluent_libc_hpt_fl_##NAME##_t *__fluent_libc_hgt_##NAME##_free_list = NULL; \
+        snprintf(key, sizeof(key), "arena.%u.muzzy_decay_ms", __fluent_libc_hg_##NAME##_jemalloc.arena); \
+        return mallctl(key, NULL, NULL, &muzzy, sizeof(muzzy)) == 0 ? 0 : -1; \
+    }                                                       \
                                                             \
-    static inline void drop_guard_##NAME(                   \
-        heap_guard_##NAME##_t **guard_ptr,                  \
-        const int is_exit                                   \
-    )                                                       \
+    static inline int heap_##NAME##_jemalloc_purge()        \
     {                                                       \
-        heap_guard_##NAME##_t *guard = *guard_ptr;          \
-                                                            \
+        if (__fluent_libc_hg_##NAME##_backing != &__fluent_libc_hg_##NAME##_jemalloc.backing) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        char key[64];                                       \
+        snprintf(key, sizeof(key), "arena.%u.purge", __fluent_libc_hg_##NAME##_jemalloc.arena); \
+        return mallctl(key, NULL, NULL, NULL, 0) == 0 ? 0 : -1; \
+    }
+
+#else
+#   define __FLUENT_LIBC_HG_JEMALLOC_API(V, NAME)
+#endif // HAVE_JEMALLOC
+
+// ============= PRESSURE MONITOR =============
+// Linux only. A background thread waits on a PSI trigger (the
+// cgroup's memory.pressure, else /proc/pressure/memory) or on
+// the cgroup's memory.events, and trims pools whenever pressure
+// rises, handing empty blocks back before the container gets
+// throttled. The monitor trims from its own thread, so a pool
+// joins the registry on its first insertion_concurrent call:
+// pools only ever used with insertion_concurrent == 0 take no
+// lock and are never trimmed behind their owner's back (call
+// heap_NAME_trim() on that thread instead). Once a pool has
+// joined, every call must pass insertion_concurrent.
+#ifdef __linux__
+
+#define HEAP_GUARD_PRESSURE_AUTO 0   // PSI, falling back to memory.events
+#define HEAP_GUARD_PRESSURE_PSI 1    // PSI trigger on memory stall time
+#define HEAP_GUARD_PRESSURE_CGROUP 2 // memory.events high/max counters
+#define HEAP_GUARD_PRESSURE_STALL_US 100000   // default stall threshold
+#define HEAP_GUARD_PRESSURE_WINDOW_US 1000000 // default PSI window
+
+// Types the monitor can trim. Registration fails past the cap and
+// the type is then only trimmed by its own heap_NAME_trim() calls.
+// The registry is process-wide, so an override has to be the same
+// in every translation unit, heap_guard.c included.
+#ifndef HEAP_GUARD_PRESSURE_MAX_POOLS
+#   define HEAP_GUARD_PRESSURE_MAX_POOLS 64
+#endif
+
+typedef size_t (*__fluent_libc_hg_trim_t)(void);
+
+typedef struct __fluent_libc_hg_pressure_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    __fluent_libc_hg_trim_t trims[HEAP_GUARD_PRESSURE_MAX_POOLS];
+    size_t trim_count;
+    size_t busy; // trim passes running outside the lock
+    int has_put_atfork_guard;
+
+    pthread_t thread;
+    int running;
+    int source;
+    int source_fd;
+    int stop_fd;
+    uint64_t last_count; // memory.events high + max
+    atomic_size_t events;
+    atomic_size_t released;
+} __fluent_libc_hg_pressure_t;
+
+#ifdef HEAP_GUARD_IMPLEMENTATION
+__fluent_libc_hg_pressure_t __fluent_libc_hg_pressure = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER
+};
+#else
+extern __fluent_libc_hg_pressure_t __fluent_libc_hg_pressure;
+#endif
+
+static inline __fluent_libc_hg_pressure_t *__fluent_libc_hg_pressure_state()
+{
+    return &__fluent_libc_hg_pressure;
+}
+
+static inline void __fluent_libc_hg_pressure_atfork_prepare()
+{
+    pthread_mutex_lock(&__fluent_libc_hg_pressure_state()->lock);
+}
+
+static inline void __fluent_libc_hg_pressure_atfork_parent()
+{
+    pthread_mutex_unlock(&__fluent_libc_hg_pressure_state()->lock);
+}
+
+static inline void __fluent_libc_hg_pressure_atfork_child()
+{
+    // The monitor thread does not survive fork(), its fds do
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    pthread_mutex_init(&state->lock, NULL);
+    pthread_cond_init(&state->idle, NULL);
+    state->busy = 0;
+
+    if (state->running)
+    {
+        close(state->source_fd);
+        close(state->stop_fd);
+        state->running = 0;
+    }
+}
+
+/**
+ * Installs the registry's atfork hooks. Called from every
+ * type's lazy init, ahead of the type's own atfork hooks.
+ */
+static inline void __fluent_libc_hg_pressure_install()
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    pthread_mutex_lock(&state->lock);
+
+    // Installed ahead of any pool's hooks so the child re-creates
+    // the registry lock before a pool resets and unregisters
+    if (!state->has_put_atfork_guard)
+    {
+        pthread_atfork(
+            __fluent_libc_hg_pressure_atfork_prepare,
+            __fluent_libc_hg_pressure_atfork_parent,
+            __fluent_libc_hg_pressure_atfork_child
+        );
+        state->has_put_atfork_guard = 1;
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Adds a type's trim function to the set the monitor runs.
+ * Called once per type, under the pool lock, from its first
+ * insertion_concurrent allocation. Returns -1 once
+ * HEAP_GUARD_PRESSURE_MAX_POOLS types are registered.
+ */
+static inline int __fluent_libc_hg_pressure_register(const __fluent_libc_hg_trim_t trim)
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    pthread_mutex_lock(&state->lock);
+    const int full = state->trim_count == HEAP_GUARD_PRESSURE_MAX_POOLS;
+    if (!full)
+    {
+        state->trims[state->trim_count++] = trim;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return full ? -1 : 0;
+}
+
+/**
+ * Removes a type's trim function and waits out any pass that
+ * may still be calling it, so the type can tear down safely.
+ */
+static inline void __fluent_libc_hg_pressure_unregister(const __fluent_libc_hg_trim_t trim)
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    pthread_mutex_lock(&state->lock);
+    for (size_t i = 0; i < state->trim_count; i++)
+    {
+        if (state->trims[i] == trim)
+        {
+            state->trims[i] = state->trims[--state->trim_count];
+            break;
+        }
+    }
+
+    while (state->busy != 0)
+    {
+        pthread_cond_wait(&state->idle, &state->lock);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Trims every registered pool, returning the bytes released.
+ * The registry lock is not held across the calls, each trim
+ * takes its own pool's mutex.
+ */
+static inline size_t heap_guard_trim_all()
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    __fluent_libc_hg_trim_t trims[HEAP_GUARD_PRESSURE_MAX_POOLS];
+
+    pthread_mutex_lock(&state->lock);
+    const size_t count = state->trim_count;
+    memcpy(trims, state->trims, count * sizeof(__fluent_libc_hg_trim_t));
+    state->busy++;
+    pthread_mutex_unlock(&state->lock);
+
+    size_t released = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        released += trims[i]();
+    }
+
+    pthread_mutex_lock(&state->lock);
+    if (--state->busy == 0)
+    {
+        pthread_cond_broadcast(&state->idle);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return released;
+}
+
+/**
+ * Writes "/sys/fs/cgroup<path>/<file>" for the calling process's
+ * cgroup v2 group into `out`. Returns -1 outside cgroup v2.
+ */
+static inline int __fluent_libc_hg_cgroup_path(char *out, const size_t out_size, const char *file)
+{
+    FILE *self = fopen("/proc/self/cgroup", "re");
+    if (self == NULL)
+    {
+        return -1;
+    }
+
+    char line[PATH_MAX];
+    int status = -1;
+    while (fgets(line, sizeof(line), self) != NULL)
+    {
+        // The unified hierarchy is the "0::<path>" entry
+        if (strncmp(line, "0::", 3) != 0)
+        {
+            continue;
+        }
+
+        line[strcspn(line, "\n")] = '\0';
+        const char *group = strcmp(line + 3, "/") == 0 ? "" : line + 3;
+        const int written = snprintf(out, out_size, "/sys/fs/cgroup%s/%s", group, file);
+        status = written > 0 && (size_t)written < out_size ? 0 : -1;
+        break;
+    }
+
+    fclose(self);
+    return status;
+}
+
+/**
+ * Opens a PSI trigger firing when tasks stall on memory for
+ * `stall_us` within any `window_us`. Returns the fd or -1.
+ */
+static inline int __fluent_libc_hg_psi_open(const char *path, const unsigned stall_us, const unsigned window_us)
+{
+    const int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    char trigger[64];
+    const int length = snprintf(trigger, sizeof(trigger), "some %u %u", stall_us, window_us);
+
+    // The trigger lives as long as the fd, the NUL is part of the write
+    if (write(fd, trigger, (size_t)length + 1) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Sums the "high" and "max" counters of a memory.events fd,
+ * the two events raised as the group approaches its limit.
+ */
+static inline uint64_t __fluent_libc_hg_cgroup_events(const int fd)
+{
+    char buffer[512];
+    const ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0)
+    {
+        return 0;
+    }
+    buffer[length] = '\0';
+
+    uint64_t count = 0;
+    for (char *line = buffer; line != NULL && *line != '\0';)
+    {
+        if (strncmp(line, "high ", 5) == 0 || strncmp(line, "max ", 4) == 0)
+        {
+            count += strtoull(strchr(line, ' ') + 1, NULL, 10);
+        }
+
+        line = strchr(line, '\n');
+        line = line != NULL ? line + 1 : NULL;
+    }
+
+    return count;
+}
+
+static inline void *__fluent_libc_hg_pressure_loop(void *arg)
+{
+    __fluent_libc_hg_pressure_t *state = (__fluent_libc_hg_pressure_t *)arg;
+    struct pollfd fds[2] = {
+        { state->source_fd, POLLPRI, 0 },
+        { state->stop_fd, POLLIN, 0 }
+    };
+
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+
+        // PSI reports POLLERR once its file goes away, kernfs
+        // flags every memory.events change with POLLERR | POLLPRI
+        if (state->source == HEAP_GUARD_PRESSURE_PSI && (fds[0].revents & (POLLERR | POLLNVAL)) != 0)
+        {
+            break;
+        }
+
+        if ((fds[0].revents & POLLPRI) == 0)
+        {
+            continue;
+        }
+
+        if (state->source == HEAP_GUARD_PRESSURE_CGROUP)
+        {
+            const uint64_t count = __fluent_libc_hg_cgroup_events(state->source_fd);
+            if (count == state->last_count)
+            {
+                continue;
+            }
+            state->last_count = count;
+        }
+
+        atomic_size_fetch_add(&state->events, 1);
+        atomic_size_fetch_add(&state->released, heap_guard_trim_all());
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts the monitor thread. `source` is one of the
+ * HEAP_GUARD_PRESSURE_* values, 0 for stall_us or window_us
+ * picks the defaults. Returns 0, or -1 if no source could be
+ * opened or a monitor is already running.
+ */
+static inline int heap_guard_pressure_start(const int source, unsigned stall_us, unsigned window_us)
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    stall_us = stall_us ? stall_us : HEAP_GUARD_PRESSURE_STALL_US;
+    window_us = window_us ? window_us : HEAP_GUARD_PRESSURE_WINDOW_US;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->running)
+    {
+        pthread_mutex_unlock(&state->lock);
+        return -1;
+    }
+
+    char path[PATH_MAX];
+    int fd = -1;
+    int resolved = HEAP_GUARD_PRESSURE_PSI;
+
+    if (source != HEAP_GUARD_PRESSURE_CGROUP)
+    {
+        // The container's own stall time first, the whole system after
+        if (__fluent_libc_hg_cgroup_path(path, sizeof(path), "memory.pressure") == 0)
+        {
+            fd = __fluent_libc_hg_psi_open(path, stall_us, window_us);
+        }
+
+        if (fd < 0)
+        {
+            fd = __fluent_libc_hg_psi_open("/proc/pressure/memory", stall_us, window_us);
+        }
+    }
+
+    if (fd < 0 && source != HEAP_GUARD_PRESSURE_PSI &&
+        __fluent_libc_hg_cgroup_path(path, sizeof(path), "memory.events") == 0)
+    {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        resolved = HEAP_GUARD_PRESSURE_CGROUP;
+    }
+
+    const int stop_fd = fd >= 0 ? eventfd(0, EFD_CLOEXEC) : -1;
+    if (stop_fd < 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        pthread_mutex_unlock(&state->lock);
+        return -1;
+    }
+
+    state->source = resolved;
+    state->source_fd = fd;
+    state->stop_fd = stop_fd;
+    state->last_count = resolved == HEAP_GUARD_PRESSURE_CGROUP ? __fluent_libc_hg_cgroup_events(fd) : 0;
+
+    if (pthread_create(&state->thread, NULL, __fluent_libc_hg_pressure_loop, state) != 0)
+    {
+        close(fd);
+        close(stop_fd);
+        pthread_mutex_unlock(&state->lock);
+        return -1;
+    }
+
+    state->running = 1;
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+}
+
+static inline void heap_guard_pressure_stop()
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    pthread_mutex_lock(&state->lock);
+    if (!state->running)
+    {
+        pthread_mutex_unlock(&state->lock);
+        return;
+    }
+    state->running = 0;
+    pthread_mutex_unlock(&state->lock);
+
+    const uint64_t one = 1;
+    (void)!write(state->stop_fd, &one, sizeof(one));
+    pthread_join(state->thread, NULL);
+
+    close(state->source_fd);
+    close(state->stop_fd);
+}
+
+/**
+ * Returns how many pressure events triggered a trim, and
+ * through `released` the bytes those trims handed back.
+ */
+static inline size_t heap_guard_pressure_events(size_t *released)
+{
+    __fluent_libc_hg_pressure_t *state = __fluent_libc_hg_pressure_state();
+    if (released != NULL)
+    {
+        *released = atomic_size_load(&state->released);
+    }
+
+    return atomic_size_load(&state->events);
+}
+
+#else
+#   define __fluent_libc_hg_pressure_install() ((void)0)
+#   define __fluent_libc_hg_pressure_register(trim) (0)
+#   define __fluent_libc_hg_pressure_unregister(trim) ((void)0)
+#endif // __linux__
+
+// ============= MEMORY LIMITS =============
+// Per-type byte budget, charged with the guard, tracker and pool
+// payload of every live allocation. When an allocation would
+// cross it the type's policy decides: fail, wait for lowers to
+// hand bytes back, or ask a reclaim callback to lower some.
+#define HEAP_GUARD_LIMIT_FAIL 0    // allocation returns NULL
+#define HEAP_GUARD_LIMIT_BLOCK 1   // wait for lowers up to the timeout, insertion_concurrent only
+#define HEAP_GUARD_LIMIT_RECLAIM 2 // run the reclaim callback, fail once it frees nothing
+
+/**
+ * Reclaim callback, asked to lower guards worth at least
+ * `needed` bytes (e.g. evict cache entries). It runs without
+ * the registry mutex held. Returns the bytes it expects to
+ * have released; 0 makes the allocation fail.
+ */
+typedef size_t (*heap_guard_reclaim_t)(size_t needed, void *ctx);
+
+#ifndef _WIN32
+typedef struct timespec __fluent_libc_hg_deadline_t;
+
+static inline void __fluent_libc_hg_deadline(__fluent_libc_hg_deadline_t *deadline, const long timeout_ms)
+{
+    // pthread_cond_timedwait() measures against CLOCK_REALTIME by default
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+#define __FLUENT_LIBC_HG_LIMIT_WAIT_API(NAME) \
+    pthread_mutex_t __fluent_libc_hg_##NAME##_wait_lock = PTHREAD_MUTEX_INITIALIZER; \
+    pthread_cond_t __fluent_libc_hg_##NAME##_wait_cond = PTHREAD_COND_INITIALIZER; \
+    size_t __fluent_libc_hg_##NAME##_wait_gen = 0;          \
+    size_t __fluent_libc_hg_##NAME##_waiters = 0;           \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_wait(       \
+        mutex_t *mutex,                                     \
+        const __fluent_libc_hg_deadline_t *deadline         \
+    )                                                       \
+    {                                                       \
+        /* Taken before the registry mutex is released so a lower in between can't be missed */ \
+        pthread_mutex_lock(&__fluent_libc_hg_##NAME##_wait_lock); \
+        const size_t gen = __fluent_libc_hg_##NAME##_wait_gen; \
+        __fluent_libc_hg_##NAME##_waiters++;                \
+        mutex_unlock(mutex);                                \
+                                                            \
+        int status = 0;                                     \
+        while (gen == __fluent_libc_hg_##NAME##_wait_gen && status == 0) \
+        {                                                   \
+            status = deadline != NULL                       \
+                ? pthread_cond_timedwait(&__fluent_libc_hg_##NAME##_wait_cond, &__fluent_libc_hg_##NAME##_wait_lock, deadline) \
+                : pthread_cond_wait(&__fluent_libc_hg_##NAME##_wait_cond, &__fluent_libc_hg_##NAME##_wait_lock); \
+        }                                                   \
+                                                            \
+        const int woken = gen != __fluent_libc_hg_##NAME##_wait_gen; \
+        __fluent_libc_hg_##NAME##_waiters--;                \
+        pthread_mutex_unlock(&__fluent_libc_hg_##NAME##_wait_lock); \
+        mutex_lock(mutex);                                  \
+        return woken ? 0 : -1;                              \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_notify()   \
+    {                                                       \
+        pthread_mutex_lock(&__fluent_libc_hg_##NAME##_wait_lock); \
+        __fluent_libc_hg_##NAME##_wait_gen++;               \
+        if (__fluent_libc_hg_##NAME##_waiters != 0)         \
+        {                                                   \
+            pthread_cond_broadcast(&__fluent_libc_hg_##NAME##_wait_cond); \
+        }                                                   \
+        pthread_mutex_unlock(&__fluent_libc_hg_##NAME##_wait_lock); \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_wait_reset() \
+    {                                                       \
+        pthread_mutex_init(&__fluent_libc_hg_##NAME##_wait_lock, NULL); \
+        pthread_cond_init(&__fluent_libc_hg_##NAME##_wait_cond, NULL); \
+        __fluent_libc_hg_##NAME##_waiters = 0;              \
+    }
+
+
+#else
+typedef ULONGLONG __fluent_libc_hg_deadline_t;
+
+static inline void __fluent_libc_hg_deadline(__fluent_libc_hg_deadline_t *deadline, const long timeout_ms)
+{
+    *deadline = GetTickCount64() + (ULONGLONG)timeout_ms;
+}
+
+#   define __FLUENT_LIBC_HG_LIMIT_WAIT_API(NAME) \
+        static inline int __fluent_libc_hp_##NAME##_wait(   \
+            mutex_t *mutex,                                 \
+            const __fluent_libc_hg_deadline_t *deadline     \
+        )                                                   \
+        {                                                   \
+            /* No condition variable next to the fluent mutex, poll instead */ \
+            if (deadline != NULL && GetTickCount64() >= *deadline) \
+            {                                               \
+                return -1;                                  \
+            }                                               \
+     \
+            mutex_unlock(mutex);                            \
+            Sleep(1);                                       \
+            mutex_lock(mutex);                              \
+            return 0;                                       \
+        }                                                   \
+     \
+        static inline void __fluent_libc_hp_##NAME##_notify() {}
+
+#endif // _WIN32
+
+// ============= GUARD LOCKS =============
+// Four-byte lock embedded in every guard, next to the refcount,
+// so locking a payload costs no extra allocation or cache line.
+// Three states (Drepper's futex mutex): 0 free, 1 held, 2 held
+// with sleepers. Lockers spin on the word first and only then
+// park, on a private futex on Linux and by yielding elsewhere.
+#ifndef HEAP_GUARD_LOCK_SPIN
+#   define HEAP_GUARD_LOCK_SPIN 128
+#endif
+
+#ifdef _WIN32
+typedef volatile LONG __fluent_libc_hg_lock_t;
+#else
+typedef _Atomic uint32_t __fluent_libc_hg_lock_t;
+#endif
+
+static inline void __fluent_libc_hg_cpu_relax()
+{
+#if defined(_WIN32)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void __fluent_libc_hg_lock_init(__fluent_libc_hg_lock_t *lock)
+{
+#ifdef _WIN32
+    *lock = 0;
+#else
+    atomic_init(lock, 0);
+#endif
+}
+
+static inline uint32_t __fluent_libc_hg_lock_peek(__fluent_libc_hg_lock_t *lock)
+{
+#ifdef _WIN32
+    return (uint32_t)*lock;
+#else
+    return atomic_load_explicit(lock, memory_order_relaxed);
+#endif
+}
+
+/**
+ * Moves the word from `expected` to `desired` with acquire
+ * ordering and returns the value it held.
+ */
+static inline uint32_t __fluent_libc_hg_lock_cas(__fluent_libc_hg_lock_t *lock, uint32_t expected, const uint32_t desired)
+{
+#ifdef _WIN32
+    return (uint32_t)InterlockedCompareExchange(lock, (LONG)desired, (LONG)expected);
+#else
+    atomic_compare_exchange_strong_explicit(lock, &expected, desired, memory_order_acquire, memory_order_relaxed);
+    return expected;
+#endif
+}
+
+static inline uint32_t __fluent_libc_hg_lock_swap(__fluent_libc_hg_lock_t *lock, const uint32_t value, const int release)
+{
+#ifdef _WIN32
+    (void)release;
+    return (uint32_t)InterlockedExchange(lock, (LONG)value);
+#else
+    return atomic_exchange_explicit(lock, value, release ? memory_order_release : memory_order_acquire);
+#endif
+}
+
+/**
+ * Sleeps while the word still reads `value`. Spurious returns
+ * are fine, callers re-check.
+ */
+static inline void __fluent_libc_hg_lock_park(__fluent_libc_hg_lock_t *lock, const uint32_t value)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, (uint32_t *)lock, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    (void)lock;
+    (void)value;
+    __fluent_libc_hg_yield();
+#endif
+}
+
+static inline void __fluent_libc_hg_lock_unpark(__fluent_libc_hg_lock_t *lock)
+{
+#if defined(__linux__)
+    syscall(SYS_futex, (uint32_t *)lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)lock;
+#endif
+}
+
+static inline int __fluent_libc_hg_lock_try(__fluent_libc_hg_lock_t *lock)
+{
+    return __fluent_libc_hg_lock_cas(lock, 0, 1) == 0;
+}
+
+static inline void __fluent_libc_hg_lock_acquire(__fluent_libc_hg_lock_t *lock)
+{
+    uint32_t state = __fluent_libc_hg_lock_cas(lock, 0, 1);
+    if (state == 0)
+    {
+        return;
+    }
+
+    // Short critical sections usually end within the spin
+    for (int i = 0; i < HEAP_GUARD_LOCK_SPIN && state != 2; i++)
+    {
+        __fluent_libc_hg_cpu_relax();
+        if (__fluent_libc_hg_lock_peek(lock) == 0)
+        {
+            state = __fluent_libc_hg_lock_cas(lock, 0, 1);
+            if (state == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    // Announce a sleeper; whoever unlocks then has to wake one
+    while (__fluent_libc_hg_lock_swap(lock, 2, 0) != 0)
+    {
+        __fluent_libc_hg_lock_park(lock, 2);
+    }
+}
+
+static inline void __fluent_libc_hg_lock_release(__fluent_libc_hg_lock_t *lock)
+{
+    if (__fluent_libc_hg_lock_swap(lock, 0, 1) == 2)
+    {
+        __fluent_libc_hg_lock_unpark(lock);
+    }
+}
+
+// Sequence word for seqlocked payloads, odd while a write is in
+// flight. Readers copy the payload without writing anything and
+// retry when the sequence moved underneath them; writers are
+// serialized by the guard lock. The copy itself races with the
+// writer by design, which sanitizers will report.
+static inline uint32_t __fluent_libc_hg_seq_read_begin(__fluent_libc_hg_lock_t *seq)
+{
+    uint32_t start;
+    for (;;)
+    {
+#ifdef _WIN32
+        start = (uint32_t)*seq;
+        MemoryBarrier();
+#else
+        start = atomic_load_explicit(seq, memory_order_acquire);
+#endif
+        if ((start & 1) == 0)
+        {
+            return start;
+        }
+
+        __fluent_libc_hg_cpu_relax();
+    }
+}
+
+static inline int __fluent_libc_hg_seq_read_retry(__fluent_libc_hg_lock_t *seq, const uint32_t start)
+{
+#ifdef _WIN32
+    MemoryBarrier();
+    return (uint32_t)*seq != start;
+#else
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+#endif
+}
+
+static inline void __fluent_libc_hg_seq_write_begin(__fluent_libc_hg_lock_t *seq)
+{
+#ifdef _WIN32
+    InterlockedIncrement(seq);
+#else
+    const uint32_t current = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, current + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+#endif
+}
+
+static inline void __fluent_libc_hg_seq_write_end(__fluent_libc_hg_lock_t *seq)
+{
+#ifdef _WIN32
+    InterlockedIncrement(seq);
+#else
+    const uint32_t current = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, current + 1, memory_order_release);
+#endif
+}
+
+// Reader-biased rwlock (BRAVO, Dice & Kogan). The word holds a
+// writer bit, a bias bit and a reader count. While biased, a
+// reader only publishes the guard in a per-CPU slot of a global
+// table, so read-side acquisition writes no shared line. A
+// writer revokes the bias, waits for the table to drain and
+// keeps bias off for a multiple of what the revocation cost.
+#ifndef HEAP_GUARD_RW_SLOTS
+#   define HEAP_GUARD_RW_SLOTS 4096
+#endif
+
+#define HEAP_GUARD_RW_WRITER 0x80000000u
+#define HEAP_GUARD_RW_BIAS 0x40000000u
+#define HEAP_GUARD_RW_READERS 0x3FFFFFFFu
+#define HEAP_GUARD_RW_INHIBIT 9
+#define HEAP_GUARD_RW_INHIBIT_MAX 1000000u // us
+
+_Static_assert((HEAP_GUARD_RW_SLOTS & (HEAP_GUARD_RW_SLOTS - 1)) == 0,
+    "heap_guard: HEAP_GUARD_RW_SLOTS must be a power of two");
+
+#ifdef _WIN32
+typedef PVOID volatile __fluent_libc_hg_rw_slot_t;
+#else
+typedef _Atomic(const void *) __fluent_libc_hg_rw_slot_t;
+#endif
+
+static inline __fluent_libc_hg_rw_slot_t *__fluent_libc_hg_rw_slots()
+{
+    static __fluent_libc_hg_rw_slot_t slots[HEAP_GUARD_RW_SLOTS];
+    return slots;
+}
+
+static inline uint32_t __fluent_libc_hg_word_load(__fluent_libc_hg_lock_t *word)
+{
+#ifdef _WIN32
+    return (uint32_t)InterlockedCompareExchange(word, 0, 0);
+#else
+    return atomic_load(word);
+#endif
+}
+
+static inline void __fluent_libc_hg_word_store(__fluent_libc_hg_lock_t *word, const uint32_t value)
+{
+#ifdef _WIN32
+    InterlockedExchange(word, (LONG)value);
+#else
+    atomic_store(word, value);
+#endif
+}
+
+static inline void __fluent_libc_hg_word_or(__fluent_libc_hg_lock_t *word, const uint32_t bits)
+{
+#ifdef _WIN32
+    InterlockedOr(word, (LONG)bits);
+#else
+    atomic_fetch_or(word, bits);
+#endif
+}
+
+static inline void __fluent_libc_hg_word_and(__fluent_libc_hg_lock_t *word, const uint32_t bits)
+{
+#ifdef _WIN32
+    InterlockedAnd(word, (LONG)bits);
+#else
+    atomic_fetch_and(word, bits);
+#endif
+}
+
+static inline void __fluent_libc_hg_word_sub(__fluent_libc_hg_lock_t *word, const uint32_t delta)
+{
+#ifdef _WIN32
+    InterlockedExchangeAdd(word, -(LONG)delta);
+#else
+    atomic_fetch_sub_explicit(word, delta, memory_order_release);
+#endif
+}
+
+/**
+ * Atomic add returning the previous value, fully ordered.
+ */
+static inline uint32_t __fluent_libc_hg_word_fetch_add(__fluent_libc_hg_lock_t *word, const uint32_t delta)
+{
+#ifdef _WIN32
+    return (uint32_t)InterlockedExchangeAdd(word, (LONG)delta);
+#else
+    return atomic_fetch_add(word, delta);
+#endif
+}
+
+/**
+ * Single-owner update, compiles to a plain store.
+ */
+static inline void __fluent_libc_hg_word_set(__fluent_libc_hg_lock_t *word, const uint32_t value)
+{
+#ifdef _WIN32
+    *word = (LONG)value;
+#else
+    atomic_store_explicit(word, value, memory_order_relaxed);
+#endif
+}
+
+static inline int __fluent_libc_hg_rw_publish(__fluent_libc_hg_rw_slot_t *slot, const void *owner)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer(slot, (PVOID)owner, NULL) == NULL;
+#else
+    const void *expected = NULL;
+    return atomic_compare_exchange_strong(slot, &expected, owner);
+#endif
+}
+
+static inline const void *__fluent_libc_hg_rw_peek(__fluent_libc_hg_rw_slot_t *slot)
+{
+#ifdef _WIN32
+    return InterlockedCompareExchangePointer(slot, NULL, NULL);
+#else
+    return atomic_load(slot);
+#endif
+}
+
+static inline void __fluent_libc_hg_rw_clear(__fluent_libc_hg_rw_slot_t *slot)
+{
+#ifdef _WIN32
+    InterlockedExchangePointer(slot, NULL);
+#else
+    atomic_store_explicit(slot, NULL, memory_order_release);
+#endif
+}
+
+/**
+ * Monotonic microseconds, truncated. Only differences are
+ * compared, so wrapping every ~71 minutes is harmless.
+ */
+static inline uint32_t __fluent_libc_hg_now_us()
+{
+#ifdef _WIN32
+    return (uint32_t)(GetTickCount64() * 1000);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u);
+#endif
+}
+
+/**
+ * Table slot for `owner` on the calling CPU. Readers of one guard
+ * on different CPUs land on different lines; collisions just send
+ * the reader down the slow path.
+ */
+static inline size_t __fluent_libc_hg_rw_slot(const void *owner)
+{
+#if defined(_WIN32)
+    const uint64_t cpu = GetCurrentProcessorNumber();
+#elif defined(__linux__)
+    const uint64_t cpu = (uint64_t)sched_getcpu();
+#else
+    static _Thread_local char self;
+    const uint64_t cpu = (uint64_t)(uintptr_t)&self >> 6;
+#endif
+    const uint64_t hash = ((uint64_t)(uintptr_t)owner ^ (cpu << 32)) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(hash >> 32) & (HEAP_GUARD_RW_SLOTS - 1);
+}
+
+static inline void __fluent_libc_hg_backoff(int *spins)
+{
+    if (++*spins < HEAP_GUARD_LOCK_SPIN)
+    {
+        __fluent_libc_hg_cpu_relax();
+    }
+    else
+    {
+        __fluent_libc_hg_yield();
+    }
+}
+
+/**
+ * Returns the token rw_read_unlock() needs: a slot index + 1 on
+ * the biased fast path, 0 when the reader count was taken.
+ */
+static inline size_t __fluent_libc_hg_rw_read_lock(__fluent_libc_hg_lock_t *rw, __fluent_libc_hg_lock_t *inhibit, const void *owner)
+{
+    if (__fluent_libc_hg_word_load(rw) & HEAP_GUARD_RW_BIAS)
+    {
+        __fluent_libc_hg_rw_slot_t *slots = __fluent_libc_hg_rw_slots();
+        const size_t slot = __fluent_libc_hg_rw_slot(owner);
+        if (__fluent_libc_hg_rw_publish(&slots[slot], owner))
+        {
+            // Re-check after publishing, a writer may be revoking
+            if (__fluent_libc_hg_word_load(rw) & HEAP_GUARD_RW_BIAS)
+            {
+                return slot + 1;
+            }
+
+            __fluent_libc_hg_rw_clear(&slots[slot]);
+        }
+    }
+
+    int spins = 0;
+    uint32_t word = __fluent_libc_hg_word_load(rw);
+    for (;;)
+    {
+        if ((word & HEAP_GUARD_RW_WRITER) == 0)
+        {
+            const uint32_t seen = __fluent_libc_hg_lock_cas(rw, word, word + 1);
+            if (seen == word)
+            {
+                break;
+            }
+
+            word = seen;
+            continue;
+        }
+
+        __fluent_libc_hg_backoff(&spins);
+        word = __fluent_libc_hg_word_load(rw);
+    }
+
+    // Holding the read side, so no writer can be mid-revocation.
+    // Inhibited while the deadline lies at most INHIBIT_MAX ahead
+    if ((word & HEAP_GUARD_RW_BIAS) == 0)
+    {
+        const uint32_t until = __fluent_libc_hg_word_load(inhibit);
+        if (until == 0 || until - __fluent_libc_hg_now_us() - 1 >= HEAP_GUARD_RW_INHIBIT_MAX)
+        {
+            __fluent_libc_hg_word_or(rw, HEAP_GUARD_RW_BIAS);
+        }
+    }
+
+    return 0;
+}
+
+static inline void __fluent_libc_hg_rw_read_unlock(__fluent_libc_hg_lock_t *rw, const size_t token)
+{
+    if (token != 0)
+    {
+        __fluent_libc_hg_rw_clear(&__fluent_libc_hg_rw_slots()[token - 1]);
+        return;
+    }
+
+    __fluent_libc_hg_word_sub(rw, 1);
+}
+
+/**
+ * Writers are serialized by `lock`, the guard's own lock.
+ */
+static inline void __fluent_libc_hg_rw_write_lock(
+    __fluent_libc_hg_lock_t *lock,
+    __fluent_libc_hg_lock_t *rw,
+    __fluent_libc_hg_lock_t *inhibit,
+    const void *owner
+)
+{
+    __fluent_libc_hg_lock_acquire(lock);
+    __fluent_libc_hg_word_or(rw, HEAP_GUARD_RW_WRITER);
+
+    int spins = 0;
+    while (__fluent_libc_hg_word_load(rw) & HEAP_GUARD_RW_READERS)
+    {
+        __fluent_libc_hg_backoff(&spins);
+    }
+
+    if ((__fluent_libc_hg_word_load(rw) & HEAP_GUARD_RW_BIAS) == 0)
+    {
+        return;
+    }
+
+    // Revoke the bias and wait out the fast-path readers
+    __fluent_libc_hg_word_and(rw, ~HEAP_GUARD_RW_BIAS);
+    const uint32_t start = __fluent_libc_hg_now_us();
+    __fluent_libc_hg_rw_slot_t *slots = __fluent_libc_hg_rw_slots();
+    for (size_t i = 0; i < HEAP_GUARD_RW_SLOTS; i++)
+    {
+        while (__fluent_libc_hg_rw_peek(&slots[i]) == owner)
+        {
+            __fluent_libc_hg_backoff(&spins);
+        }
+    }
+
+    const uint32_t now = __fluent_libc_hg_now_us();
+    uint32_t window = (now - start) * HEAP_GUARD_RW_INHIBIT;
+    if (window >= HEAP_GUARD_RW_INHIBIT_MAX || now - start >= HEAP_GUARD_RW_INHIBIT_MAX)
+    {
+        window = HEAP_GUARD_RW_INHIBIT_MAX - 1;
+    }
+
+    __fluent_libc_hg_word_store(inhibit, (now + window) | 1);
+}
+
+static inline void __fluent_libc_hg_rw_write_unlock(__fluent_libc_hg_lock_t *lock, __fluent_libc_hg_lock_t *rw)
+{
+    __fluent_libc_hg_word_and(rw, ~HEAP_GUARD_RW_WRITER);
+    __fluent_libc_hg_lock_release(lock);
+}
+
+// ============= IMMORTAL GUARDS =============
+// A count at or above the floor marks a process-lifetime guard:
+// raise and lower only read it, and it is released with the rest
+// of the pool at exit. The sentinel sits far above the floor, so
+// raises and lowers racing with make_immortal() cannot bring the
+// count back below it.
+#define HEAP_GUARD_IMMORTAL (SIZE_MAX >> 1)
+#define HEAP_GUARD_IMMORTAL_FLOOR (SIZE_MAX >> 2)
+
+// ============= ORIGINS =============
+#define HEAP_GUARD_ORIGIN_POOL 0     // payload comes from the type's slab
+#define HEAP_GUARD_ORIGIN_EXTERNAL 1 // payload passed in as default_ptr, never recycled
+#define HEAP_GUARD_ORIGIN_HEAP 2     // array payload from the aligned heap
+#define HEAP_GUARD_ORIGIN_MAPPED 3   // large array payload mapped on its own
+#define HEAP_GUARD_ORIGIN_ADOPTED 4  // foreign buffer, handed to its releaser at the end
+#define HEAP_GUARD_ORIGIN_INLINE 5   // small payload stored in the guard's own slot
+
+// Payloads up to this size (and no more than max_align_t aligned)
+// are stored right behind the guard header: one slab slot and one
+// allocation instead of two. A full header is 64 bytes on LP64,
+// so its payload always starts past the header's first cache
+// line; a compact header is 16 bytes and usually shares one.
+#ifndef HEAP_GUARD_INLINE_MAX
+#   define HEAP_GUARD_INLINE_MAX 16
+#endif
+
+/**
+ * Deallocator for adopted payloads, called once with the
+ * payload and its size in bytes when the last reference goes.
+ * One releaser can be shared by every buffer of an origin.
+ */
+typedef struct heap_guard_releaser_t
+{
+    void (*release)(void *ptr, size_t bytes, void *ctx);
+    void *ctx;
+} heap_guard_releaser_t;
+
+static inline void __fluent_libc_hg_release_free(void *ptr, const size_t bytes, void *ctx)
+{
+    (void)bytes;
+    (void)ctx;
+    free(ptr);
+}
+
+static inline const heap_guard_releaser_t *heap_guard_releaser_free()
+{
+    static const heap_guard_releaser_t releaser = { __fluent_libc_hg_release_free, NULL };
+    return &releaser;
+}
+
+#ifndef _WIN32
+static inline void __fluent_libc_hg_release_munmap(void *ptr, const size_t bytes, void *ctx)
+{
+    (void)ctx;
+    munmap(ptr, bytes);
+}
+
+static inline const heap_guard_releaser_t *heap_guard_releaser_munmap()
+{
+    static const heap_guard_releaser_t releaser = { __fluent_libc_hg_release_munmap, NULL };
+    return &releaser;
+}
+#endif
+
+// ============= LARGE OBJECTS =============
+// Array payloads skip the fixed-size slabs. Arrays under the
+// threshold come from the aligned heap; larger ones get their
+// own anonymous mapping (POSIX), grow in place with mremap()
+// where Linux allows it, and are unmapped on final release.
+#ifndef HEAP_GUARD_LARGE_THRESHOLD
+#   define HEAP_GUARD_LARGE_THRESHOLD (256 * 1024)
+#endif
+
+static inline size_t __fluent_libc_hg_page_size()
+{
+#ifndef _WIN32
+    static size_t page = 0;
+    if (page == 0)
+    {
+        const long queried = sysconf(_SC_PAGESIZE);
+        page = queried > 0 ? (size_t)queried : 4096;
+    }
+
+    return page;
+#else
+    return 4096;
+#endif
+}
+
+/**
+ * Returns where an array payload of `bytes` bytes lives, so
+ * budgets can be charged before the payload exists.
+ */
+static inline int __fluent_libc_hg_large_origin(const size_t bytes)
+{
+#ifndef _WIN32
+    return bytes >= HEAP_GUARD_LARGE_THRESHOLD ? HEAP_GUARD_ORIGIN_MAPPED : HEAP_GUARD_ORIGIN_HEAP;
+#else
+    (void)bytes;
+    return HEAP_GUARD_ORIGIN_HEAP;
+#endif
+}
+
+/**
+ * Bytes actually held by an array payload, mappings count in
+ * whole pages.
+ */
+static inline size_t __fluent_libc_hg_large_footprint(const size_t bytes, const int origin)
+{
+    return origin == HEAP_GUARD_ORIGIN_MAPPED
+        ? __fluent_libc_hg_align_up(bytes, __fluent_libc_hg_page_size())
+        : bytes;
+}
+
+static inline void *__fluent_libc_hg_large_alloc(const size_t bytes, size_t align)
+{
+#ifndef _WIN32
+    if (__fluent_libc_hg_large_origin(bytes) == HEAP_GUARD_ORIGIN_MAPPED)
+    {
+        // Page alignment covers every ALIGN the slabs accept
+        void *map = mmap(NULL, __fluent_libc_hg_large_footprint(bytes, HEAP_GUARD_ORIGIN_MAPPED),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return map == MAP_FAILED ? NULL : map;
+    }
+
+    if (align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+
+    void *ptr = NULL;
+    return posix_memalign(&ptr, align, bytes) == 0 ? ptr : NULL;
+#else
+    return _aligned_malloc(bytes, align);
+#endif
+}
+
+static inline void __fluent_libc_hg_large_free(void *ptr, const size_t bytes, const int origin)
+{
+#ifndef _WIN32
+    if (origin == HEAP_GUARD_ORIGIN_MAPPED)
+    {
+        munmap(ptr, __fluent_libc_hg_large_footprint(bytes, HEAP_GUARD_ORIGIN_MAPPED));
+        return;
+    }
+
+    (void)bytes;
+    free(ptr);
+#else
+    (void)bytes;
+    (void)origin;
+    _aligned_free(ptr);
+#endif
+}
+
+/**
+ * Grows an array payload to `new_bytes`, moving it between the
+ * heap and a mapping when it crosses the threshold. Returns the
+ * new address (the old one is released) or NULL, leaving the
+ * payload untouched.
+ */
+static inline void *__fluent_libc_hg_large_grow(
+    void *ptr,
+    const size_t old_bytes,
+    const size_t new_bytes,
+    const size_t align,
+    const int origin
+)
+{
+    const int target = __fluent_libc_hg_large_origin(new_bytes);
+
+#if defined(__linux__)
+    if (origin == HEAP_GUARD_ORIGIN_MAPPED)
+    {
+        void *map = mremap(
+            ptr,
+            __fluent_libc_hg_large_footprint(old_bytes, origin),
+            __fluent_libc_hg_large_footprint(new_bytes, origin),
+            MREMAP_MAYMOVE
+        );
+        return map == MAP_FAILED ? NULL : map;
+    }
+#endif
+
+#ifndef _WIN32
+    if (origin == HEAP_GUARD_ORIGIN_HEAP && target == HEAP_GUARD_ORIGIN_HEAP && align <= _Alignof(max_align_t))
+    {
+        return realloc(ptr, new_bytes);
+    }
+#else
+    (void)target;
+    if (origin == HEAP_GUARD_ORIGIN_HEAP)
+    {
+        return _aligned_realloc(ptr, new_bytes, align);
+    }
+#endif
+
+    void *grown = __fluent_libc_hg_large_alloc(new_bytes, align);
+    if (grown == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(grown, ptr, old_bytes);
+    __fluent_libc_hg_large_free(ptr, old_bytes, origin);
+    return grown;
+}
+
+// Rwlock words are opt-in: only DEFINE_HEAP_GUARD_RW types pay
+// for them in the header.
+#define __FLUENT_LIBC_HG_RW_FIELDS_0
+#define __FLUENT_LIBC_HG_RW_INIT_0(guard)
+#define __FLUENT_LIBC_HG_RW_API_0(V, NAME)
+
+#define __FLUENT_LIBC_HG_RW_FIELDS_1                        \
+        __fluent_libc_hg_lock_t __rw; /* reader-biased rwlock word */ \
+        __fluent_libc_hg_lock_t __inhibit; /* no bias before this (us) */
+
+#define __FLUENT_LIBC_HG_RW_INIT_1(guard)                   \
+        __fluent_libc_hg_lock_init(&(guard)->__rw);         \
+        __fluent_libc_hg_lock_init(&(guard)->__inhibit);
+
+#define __FLUENT_LIBC_HG_RW_API_1(V, NAME)                  \
+    static inline size_t rdlock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        return __fluent_libc_hg_rw_read_lock(&guard->__rw, &guard->__inhibit, guard); \
+    }                                                       \
+                                                            \
+    static inline void rdunlock_guard_##NAME(heap_guard_##NAME##_t *guard, const size_t token) \
+    {                                                       \
+        __fluent_libc_hg_rw_read_unlock(&guard->__rw, token); \
+    }                                                       \
+                                                            \
+    static inline void wrlock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_rw_write_lock(&guard->__lock, &guard->__rw, &guard->__inhibit, guard); \
+    }                                                       \
+                                                            \
+    static inline void wrunlock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_rw_write_unlock(&guard->__lock, &guard->__rw); \
+    }
+
+// ============= MACRO =============
+// Payload slots are aligned to ALIGN (a power of two, never
+// below _Alignof(V)), e.g. 64 for aligned SIMD loads or DMA.
+#define DEFINE_HEAP_GUARD(V, NAME, ARENA_SIZE) \
+    DEFINE_HEAP_GUARD_ALIGNED(V, NAME, ARENA_SIZE, _Alignof(V))
+
+#define DEFINE_HEAP_GUARD_ALIGNED(V, NAME, ARENA_SIZE, ALIGN) \
+    __FLUENT_LIBC_HG_DEFINE_GUARD(V, NAME, ARENA_SIZE, ALIGN, 0)
+
+// Same as DEFINE_HEAP_GUARD, plus the reader-biased rwlock
+#define DEFINE_HEAP_GUARD_RW(V, NAME, ARENA_SIZE)           \
+    __FLUENT_LIBC_HG_DEFINE_GUARD(V, NAME, ARENA_SIZE, _Alignof(V), 1)
+
+#define __FLUENT_LIBC_HG_DEFINE_GUARD(V, NAME, ARENA_SIZE, ALIGN, RW) \
+    _Static_assert(((ALIGN) & ((ALIGN) - 1)) == 0 && (ALIGN) <= HEAP_GUARD_SLAB_MIN_BLOCK, \
+        "heap_guard: ALIGN must be a power of two up to the slab block size"); \
+                                                            \
+    int __fluent_libc_hg_##NAME##_has_put_atexit_guard = 0; \
+                                                            \
+    typedef struct heap_guard_##NAME##_t                    \
+    {                                                       \
+        V *ptr;                                             \
+        size_t allocated; /* payload length in elements of V */ \
+        union                                               \
+        {                                                   \
+            size_t ref_count; /* concurrent == 0 */         \
+            atomic_size_t concurrent_ref; /* concurrent == 1 */ \
+        };                                                  \
+        __fluent_libc_hg_lock_t __lock; /* lock_guard/unlock_guard */ \
+        __fluent_libc_hg_lock_t __seq; /* seqlocked reads, fills the padding */ \
+        __FLUENT_LIBC_HG_RW_FIELDS_##RW                     \
+        uint8_t concurrent;                                 \
+        uint8_t __origin;                                   \
+        void (*destructor)                                  \
+            (const struct heap_guard_##NAME##_t *guard, int is_exit); \
+        void *__tracker;                                    \
+        const heap_guard_releaser_t *__releaser; /* ADOPTED payloads only */ \
+    } heap_guard_##NAME##_t;                                \
+                                                            \
+    typedef void (*heap_##NAME##_destructor_t)(const heap_guard_##NAME##_t *guard, int is_exit); \
+                                                            \
+    typedef struct __fluent_libc_heap_##NAME##_tracker_t    \
+    {                                                       \
+        heap_guard_##NAME##_t *guard;                       \
+        struct __fluent_libc_heap_##NAME##_tracker_t *next; \
+        struct __fluent_libc_heap_##NAME##_tracker_t *prev; \
+        struct __fluent_libc_heap_##NAME##_tracker_t *tail; \
+    } __fluent_libc_heap_##NAME##_tracker_t;                \
+                                                            \
+    __fluent_libc_heap_##NAME##_tracker_t *__fluent_libc_impl_heap_##NAME##_guards = NULL; \
+    mutex_t *__fluent_libc_impl_hg_##NAME##_mutex = NULL;   \
+                                                            \
+    int __fluent_libc_hg_##NAME##_slabs_ready = 0;          \
+    int __fluent_libc_hg_##NAME##_trim_registered = 0; /* under the mutex */ \
+    atomic_size_t __fluent_libc_hg_##NAME##_init_state;     \
+    __fluent_libc_hg_slab_t __fluent_libc_hg_##NAME##_val_slab; \
+    __fluent_libc_hg_slab_t __fluent_libc_hg_##NAME##_guard_slab; \
+    __fluent_libc_hg_slab_t __fluent_libc_hg_##NAME##_tracker_slab; \
+    const heap_guard_backing_t *__fluent_libc_hg_##NAME##_backing = NULL; \
+                                                            \
+    size_t __fluent_libc_hg_##NAME##_limit = 0;             \
+    size_t __fluent_libc_hg_##NAME##_usage = 0;             \
+    int __fluent_libc_hg_##NAME##_limit_policy = HEAP_GUARD_LIMIT_FAIL; \
+    long __fluent_libc_hg_##NAME##_limit_timeout = -1;      \
+    heap_guard_reclaim_t __fluent_libc_hg_##NAME##_reclaim = NULL; \
+    void *__fluent_libc_hg_##NAME##_reclaim_ctx = NULL;     \
+                                                            \
+    static inline const heap_guard_backing_t *__fluent_libc_hp_##NAME##_backing() \
+    {                                                       \
+        return __fluent_libc_hg_##NAME##_backing ? __fluent_libc_hg_##NAME##_backing : heap_guard_backing_malloc(); \
+    }                                                       \
+                                                            \
+    static inline int heap_##NAME##_set_backing(const heap_guard_backing_t *backing) \
+    {                                                       \
+        if (atomic_size_load(&__fluent_libc_hg_##NAME##_init_state) != 0) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_##NAME##_backing = backing;        \
+        __fluent_libc_hg_##NAME##_val_slab.backing = backing; \
+        __fluent_libc_hg_##NAME##_guard_slab.backing = backing; \
+        __fluent_libc_hg_##NAME##_tracker_slab.backing = backing; \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_footprint()          \
+    {                                                       \
+        return __fluent_libc_hg_##NAME##_val_slab.block_count * __fluent_libc_hg_##NAME##_val_slab.block_size + \
+            __fluent_libc_hg_##NAME##_guard_slab.block_count * __fluent_libc_hg_##NAME##_guard_slab.block_size + \
+            __fluent_libc_hg_##NAME##_tracker_slab.block_count * __fluent_libc_hg_##NAME##_tracker_slab.block_size; \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_trim()               \
+    {                                                       \
+        if (!__fluent_libc_hg_##NAME##_slabs_ready)         \
+        {                                                   \
+            return 0;                                       \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = __fluent_libc_impl_hg_##NAME##_mutex; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+        }                                                   \
+                                                            \
+        const size_t released = __fluent_libc_hg_slab_trim(&__fluent_libc_hg_##NAME##_val_slab) + \
+            __fluent_libc_hg_slab_trim(&__fluent_libc_hg_##NAME##_guard_slab) + \
+            __fluent_libc_hg_slab_trim(&__fluent_libc_hg_##NAME##_tracker_slab); \
+                                                            \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+                                                            \
+        const heap_guard_backing_t *backing = __fluent_libc_hp_##NAME##_backing(); \
+        if (backing->trim != NULL)                          \
+        {                                                   \
+            backing->trim(backing->ctx);                    \
+        }                                                   \
+                                                            \
+        return released;                                    \
+    }                                                       \
+                                                            \
+    __FLUENT_LIBC_HG_LIMIT_WAIT_API(NAME)                   \
+                                                            \
+    static inline void heap_##NAME##_set_limit(const size_t bytes, const int policy, const long timeout_ms) \
+    {                                                       \
+        mutex_t *mutex = __fluent_libc_impl_hg_##NAME##_mutex; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_##NAME##_limit = bytes;            \
+        __fluent_libc_hg_##NAME##_limit_policy = policy;    \
+        __fluent_libc_hg_##NAME##_limit_timeout = timeout_ms; \
+                                                            \
+        /* Waiters re-check against the new budget */       \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            __fluent_libc_hp_##NAME##_notify();             \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_set_reclaim(const heap_guard_reclaim_t reclaim, void *ctx) \
+    {                                                       \
+        __fluent_libc_hg_##NAME##_reclaim = reclaim;        \
+        __fluent_libc_hg_##NAME##_reclaim_ctx = ctx;        \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_usage()              \
+    {                                                       \
+        return __fluent_libc_hg_##NAME##_usage;             \
+    }                                                       \
+                                                            \
+    static inline size_t __fluent_libc_hp_##NAME##_align()  \
+    {                                                       \
+        return (ALIGN) > _Alignof(V) ? (ALIGN) : _Alignof(V); \
+    }                                                       \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_inline()    \
+    {                                                       \
+        /* Folded at compile time */                        \
+        return sizeof(V) <= HEAP_GUARD_INLINE_MAX && __fluent_libc_hp_##NAME##_align() <= _Alignof(max_align_t); \
+    }                                                       \
+                                                            \
+    static inline size_t __fluent_libc_hp_##NAME##_inline_offset() \
+    {                                                       \
+        /* 64 on LP64, 72 with the rwlock words */          \
+        return __fluent_libc_hg_align_up(sizeof(heap_guard_##NAME##_t), __fluent_libc_hp_##NAME##_align()); \
+    }                                                       \
+                                                            \
+    static inline size_t __fluent_libc_hp_##NAME##_charge(const int origin, const size_t count) \
+    {                                                       \
+        size_t payload = 0;                                 \
+        if (origin == HEAP_GUARD_ORIGIN_POOL)               \
+        {                                                   \
+            payload = __fluent_libc_hg_##NAME##_val_slab.slot_size; \
+        }                                                   \
+        else if (origin == HEAP_GUARD_ORIGIN_INLINE)        \
+        {                                                   \
+            payload = __fluent_libc_hg_##NAME##_guard_slab.slot_size - sizeof(heap_guard_##NAME##_t); \
+        }                                                   \
+        else if (origin != HEAP_GUARD_ORIGIN_EXTERNAL)      \
+        {                                                   \
+            payload = __fluent_libc_hg_large_footprint(count * sizeof(V), origin); \
+        }                                                   \
+                                                            \
+        return sizeof(heap_guard_##NAME##_t) + sizeof(__fluent_libc_heap_##NAME##_tracker_t) + payload; \
+    }                                                       \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_reserve(mutex_t *mutex, const size_t bytes) \
+    {                                                       \
+        __fluent_libc_hg_deadline_t deadline;               \
+        int has_deadline = 0;                               \
+                                                            \
+        while (__fluent_libc_hg_##NAME##_limit != 0 &&      \
+            __fluent_libc_hg_##NAME##_usage + bytes > __fluent_libc_hg_##NAME##_limit) \
+        {                                                   \
+            const int policy = __fluent_libc_hg_##NAME##_limit_policy; \
+            const long timeout_ms = __fluent_libc_hg_##NAME##_limit_timeout; \
+                                                            \
+            if (policy == HEAP_GUARD_LIMIT_RECLAIM && __fluent_libc_hg_##NAME##_reclaim != NULL) \
+            {                                               \
+                const size_t needed = __fluent_libc_hg_##NAME##_usage + bytes - __fluent_libc_hg_##NAME##_limit; \
+                                                            \
+                /* The callback lowers guards, which takes the mutex itself */ \
+                if (mutex != NULL)                          \
+                {                                           \
+                    mutex_unlock(mutex);                    \
+                }                                           \
+                                                            \
+                const size_t released = __fluent_libc_hg_##NAME##_reclaim(needed, __fluent_libc_hg_##NAME##_reclaim_ctx); \
+                                                            \
+                if (mutex != NULL)                          \
+                {                                           \
+                    mutex_lock(mutex);                      \
+                }                                           \
+                                                            \
+                if (released == 0)                          \
+                {                                           \
+                    return -1;                              \
+                }                                           \
+            }                                               \
+            else if (policy == HEAP_GUARD_LIMIT_BLOCK && mutex != NULL) \
+            {                                               \
+                if (!has_deadline && timeout_ms >= 0)       \
+                {                                           \
+                    __fluent_libc_hg_deadline(&deadline, timeout_ms); \
+                    has_deadline = 1;                       \
+                }                                           \
+                                                            \
+                if (__fluent_libc_hp_##NAME##_wait(mutex, has_deadline ? &deadline : NULL) != 0) \
+                {                                           \
+                    return -1;                              \
+                }                                           \
+            }                                               \
+            else                                            \
+            {                                               \
+                return -1;                                  \
+            }                                               \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_##NAME##_usage += bytes;           \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    __FLUENT_LIBC_HG_JEMALLOC_API(V, NAME)                  \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_free_payload( \
+        V *ptr,                                             \
+        const size_t count,                                 \
+        const int origin,                                   \
+        const heap_guard_releaser_t *releaser               \
+    )                                                       \
+    {                                                       \
+        if (ptr == NULL)                                    \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        if (origin == HEAP_GUARD_ORIGIN_HEAP || origin == HEAP_GUARD_ORIGIN_MAPPED) \
+        {                                                   \
+            __fluent_libc_hg_large_free(ptr, count * sizeof(V), origin); \
+        }                                                   \
+        else if (origin == HEAP_GUARD_ORIGIN_ADOPTED && releaser != NULL) \
+        {                                                   \
+            releaser->release(ptr, count * sizeof(V), releaser->ctx); \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_release_payload(const heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hp_##NAME##_free_payload(guard->ptr, guard->allocated, guard->__origin, guard->__releaser); \
+    }                                                       \
+                                                            \
+    static inline void drop_guard_##NAME(                   \
+        heap_guard_##NAME##_t **guard_ptr,                  \
+        const int is_exit                                   \
+    )                                                       \
+    {                                                       \
+        heap_guard_##NAME##_t *guard = *guard_ptr;          \
+                                                            \
         if (guard->destructor != NULL)                      \
         {                                                   \
-            guard->destructor(guard, is_exit);              \
+            guard->destructor(guard, is_exit);              \
+        }                                                   \
+                                                            \
+        if (!is_exit)                                       \
+        {                                                   \
+            if (guard->ptr != NULL && guard->__origin == HEAP_GUARD_ORIGIN_POOL) \
+            {                                               \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_val_slab, guard->ptr); \
+            }                                               \
+            else                                            \
+            {                                               \
+                __fluent_libc_hp_##NAME##_release_payload(guard); \
+            }                                               \
+                                                            \
+            __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_guard_slab, guard); \
+        }                                                   \
+                                                            \
+        *guard_ptr = NULL;                                  \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_destroy()  \
+    {                                                       \
+        __fluent_libc_heap_##NAME##_tracker_t *current = __fluent_libc_impl_heap_##NAME##_guards; \
+                                                            \
+        while (current != NULL)                             \
+        {                                                   \
+            heap_guard_##NAME##_t *guard = current->guard;  \
+                                                            \
+           if (guard != NULL)                               \
+           {                                                \
+               /* Slab payloads go with their blocks below, the rest one by one */ \
+               heap_guard_##NAME##_t *dropped = guard;      \
+               drop_guard_##NAME(&guard, 1);                \
+               __fluent_libc_hp_##NAME##_release_payload(dropped); \
+           }                                                \
+                                                            \
+           current = current->next;                         \
+        }                                                   \
+                                                            \
+        __fluent_libc_impl_heap_##NAME##_guards = NULL;     \
+        __fluent_libc_hg_##NAME##_usage = 0;                \
+                                                            \
+        if (__fluent_libc_hg_##NAME##_slabs_ready)          \
+        {                                                   \
+            __fluent_libc_hg_pressure_unregister(heap_##NAME##_trim); \
+            __fluent_libc_hg_##NAME##_trim_registered = 0;  \
+            __fluent_libc_hg_slab_destroy(&__fluent_libc_hg_##NAME##_val_slab); \
+            __fluent_libc_hg_slab_destroy(&__fluent_libc_hg_##NAME##_guard_slab); \
+            __fluent_libc_hg_slab_destroy(&__fluent_libc_hg_##NAME##_tracker_slab); \
+            __fluent_libc_hg_##NAME##_slabs_ready = 0;      \
+        }                                                   \
+                                                            \
+        if (__fluent_libc_impl_hg_##NAME##_mutex != NULL)   \
+        {                                                   \
+            mutex_destroy(__fluent_libc_impl_hg_##NAME##_mutex); \
+            __fluent_libc_hp_##NAME##_backing()->block_free(__fluent_libc_hp_##NAME##_backing()->ctx, __fluent_libc_impl_hg_##NAME##_mutex, sizeof(mutex_t)); \
+            __fluent_libc_impl_hg_##NAME##_mutex = NULL;    \
+        }                                                   \
+                                                            \
+        atomic_size_store(&__fluent_libc_hg_##NAME##_init_state, 0); \
+    }                                                       \
+                                                            \
+    __FLUENT_LIBC_HG_FORK_API(V, NAME)                      \
+                                                            \
+    static __fluent_libc_heap_##NAME##_tracker_t * __fluent_libc_hp_##NAME##_req_tracker() \
+    {                                                       \
+        if (__fluent_libc_hg_fault(HEAP_GUARD_FAULT_TRACKER)) \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        return (__fluent_libc_heap_##NAME##_tracker_t *)__fluent_libc_hg_slab_malloc(&__fluent_libc_hg_##NAME##_tracker_slab); \
+    }                                                       \
+                                                            \
+    static heap_guard_##NAME##_t * __fluent_libc_hp_##NAME##_req_guard() \
+    {                                                       \
+        if (__fluent_libc_hg_fault(HEAP_GUARD_FAULT_GUARD)) \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        return (heap_guard_##NAME##_t *)__fluent_libc_hg_slab_malloc(&__fluent_libc_hg_##NAME##_guard_slab); \
+    }                                                       \
+                                                            \
+    static V *__fluent_libc_hp_##NAME##_req_ptr()           \
+    {                                                       \
+        if (__fluent_libc_hg_fault(HEAP_GUARD_FAULT_PAYLOAD)) \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        return (V *)__fluent_libc_hg_slab_malloc(&__fluent_libc_hg_##NAME##_val_slab); \
+    }                                                       \
+                                                            \
+    static inline mutex_t *__fluent_libc_hp_##NAME##_req_mutex() \
+    {                                                       \
+        if (__fluent_libc_impl_hg_##NAME##_mutex == NULL && !__fluent_libc_hg_fault(HEAP_GUARD_FAULT_MUTEX)) \
+        {                                                   \
+            const heap_guard_backing_t *backing = __fluent_libc_hp_##NAME##_backing(); \
+            mutex_t *mutex = (mutex_t *)backing->block_alloc(backing->ctx, sizeof(mutex_t), _Alignof(mutex_t)); \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_init(mutex);                          \
+                __fluent_libc_impl_hg_##NAME##_mutex = mutex; \
+            }                                               \
+        }                                                   \
+                                                            \
+        return __fluent_libc_impl_hg_##NAME##_mutex;        \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_track(__fluent_libc_heap_##NAME##_tracker_t *node) \
+    {                                                       \
+        __fluent_libc_heap_##NAME##_tracker_t *head = __fluent_libc_impl_heap_##NAME##_guards; \
+        node->next = NULL;                                  \
+        node->tail = NULL;                                  \
+                                                            \
+        if (head == NULL)                                   \
+        {                                                   \
+            node->prev = NULL;                              \
+            node->tail = node;                              \
+            __fluent_libc_impl_heap_##NAME##_guards = node; \
+            return;                                         \
+        }                                                   \
+                                                            \
+        node->prev = head->tail;                            \
+        head->tail->next = node;                            \
+        head->tail = node;                                  \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_untrack(__fluent_libc_heap_##NAME##_tracker_t *node) \
+    {                                                       \
+        __fluent_libc_heap_##NAME##_tracker_t *tail = __fluent_libc_impl_heap_##NAME##_guards->tail; \
+        if (tail == node)                                   \
+        {                                                   \
+            tail = node->prev;                              \
+        }                                                   \
+                                                            \
+        if (node->prev != NULL)                             \
+        {                                                   \
+            node->prev->next = node->next;                  \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            __fluent_libc_impl_heap_##NAME##_guards = node->next; \
+        }                                                   \
+                                                            \
+        if (node->next != NULL)                             \
+        {                                                   \
+            node->next->prev = node->prev;                  \
+        }                                                   \
+                                                            \
+        if (__fluent_libc_impl_heap_##NAME##_guards != NULL) \
+        {                                                   \
+            __fluent_libc_impl_heap_##NAME##_guards->tail = tail; \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_init()      \
+    {                                                       \
+        if (atomic_size_load(&__fluent_libc_hg_##NAME##_init_state) == 2) \
+        {                                                   \
+            return 0;                                       \
+        }                                                   \
+                                                            \
+        /* 0 = untouched, 1 = being set up by another thread, 2 = ready */ \
+        for (;;)                                            \
+        {                                                   \
+            size_t expected = 0;                            \
+            if (atomic_size_compare_exchange(&__fluent_libc_hg_##NAME##_init_state, &expected, 1)) \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (expected == 2)                              \
+            {                                               \
+                return 0;                                   \
+            }                                               \
+                                                            \
+            __fluent_libc_hg_yield();                       \
+        }                                                   \
+                                                            \
+        if (__fluent_libc_hp_##NAME##_req_mutex() == NULL)  \
+        {                                                   \
+            atomic_size_store(&__fluent_libc_hg_##NAME##_init_state, 0); \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        if (!__fluent_libc_hg_##NAME##_has_put_atexit_guard) \
+        {                                                   \
+            atexit(__fluent_libc_hp_##NAME##_destroy);      \
+            __fluent_libc_hg_##NAME##_has_put_atexit_guard = 1; \
+        }                                                   \
+                                                            \
+        /* Before the type's own atfork hooks, see the pressure monitor */ \
+        __fluent_libc_hg_pressure_install();                \
+        __fluent_libc_hp_##NAME##_register_atfork();        \
+                                                            \
+        __fluent_libc_hg_slab_init(&__fluent_libc_hg_##NAME##_val_slab, sizeof(V), __fluent_libc_hp_##NAME##_align(), ARENA_SIZE); \
+        __fluent_libc_hg_slab_init(                         \
+            &__fluent_libc_hg_##NAME##_guard_slab,          \
+            __fluent_libc_hp_##NAME##_inline() ? __fluent_libc_hp_##NAME##_inline_offset() + sizeof(V) : sizeof(heap_guard_##NAME##_t), \
+            __fluent_libc_hp_##NAME##_inline() && __fluent_libc_hp_##NAME##_align() > _Alignof(heap_guard_##NAME##_t) \
+                ? __fluent_libc_hp_##NAME##_align() : _Alignof(heap_guard_##NAME##_t), \
+            ARENA_SIZE                                      \
+        );                                                  \
+        __fluent_libc_hg_slab_init(&__fluent_libc_hg_##NAME##_tracker_slab, sizeof(__fluent_libc_heap_##NAME##_tracker_t), _Alignof(__fluent_libc_heap_##NAME##_tracker_t), ARENA_SIZE); \
+        __fluent_libc_hg_##NAME##_slabs_ready = 1;          \
+                                                            \
+        atomic_size_store(&__fluent_libc_hg_##NAME##_init_state, 2); \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *__fluent_libc_hp_##NAME##_alloc_guard( \
+        const int is_concurrent,                            \
+        const int insertion_concurrent,                     \
+        const heap_##NAME##_destructor_t destructor,        \
+        V *payload,                                         \
+        const int origin,                                   \
+        const size_t count                                  \
+    )                                                       \
+    {                                                       \
+        if (__fluent_libc_hp_##NAME##_init() != 0)          \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = insertion_concurrent ? __fluent_libc_impl_hg_##NAME##_mutex : NULL; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+                                                            \
+            /* Only pools that take the mutex can be trimmed by the monitor */ \
+            /* A full registry leaves the pool to heap_NAME_trim() */ \
+            if (!__fluent_libc_hg_##NAME##_trim_registered) \
+            {                                               \
+                (void)__fluent_libc_hg_pressure_register(heap_##NAME##_trim); \
+                __fluent_libc_hg_##NAME##_trim_registered = 1; \
+            }                                               \
+        }                                                   \
+                                                            \
+        const size_t charge = __fluent_libc_hp_##NAME##_charge(origin, count); \
+        if (__fluent_libc_hp_##NAME##_reserve(mutex, charge) != 0) \
+        {                                                   \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_unlock(mutex);                        \
+            }                                               \
+                                                            \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        heap_guard_##NAME##_t *guard = __fluent_libc_hp_##NAME##_req_guard(); \
+        V *ptr = payload;                                   \
+        if (guard != NULL && ptr == NULL && origin == HEAP_GUARD_ORIGIN_POOL) \
+        {                                                   \
+            ptr = __fluent_libc_hp_##NAME##_req_ptr();      \
+        }                                                   \
+        else if (guard != NULL && origin == HEAP_GUARD_ORIGIN_INLINE) \
+        {                                                   \
+            ptr = (V *)((char *)guard + __fluent_libc_hp_##NAME##_inline_offset()); \
+        }                                                   \
+                                                            \
+        __fluent_libc_heap_##NAME##_tracker_t *node = guard != NULL && ptr != NULL \
+            ? __fluent_libc_hp_##NAME##_req_tracker()       \
+            : NULL;                                         \
+                                                            \
+        if (node == NULL)                                   \
+        {                                                   \
+            /* Give back whatever was taken before the failure */ \
+            __fluent_libc_hg_##NAME##_usage -= charge;      \
+            if (ptr != NULL && payload == NULL && origin == HEAP_GUARD_ORIGIN_POOL) \
+            {                                               \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_val_slab, ptr); \
+            }                                               \
+                                                            \
+            if (guard != NULL)                              \
+            {                                               \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_guard_slab, guard); \
+            }                                               \
+                                                            \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_unlock(mutex);                        \
+            }                                               \
+                                                            \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        guard->ptr = ptr;                                   \
+        guard->__origin = origin;                           \
+        guard->allocated = count;                           \
+        guard->ref_count = 1;                               \
+        guard->concurrent = is_concurrent;                  \
+        guard->destructor = destructor;                     \
+        guard->__tracker = node;                            \
+        guard->__releaser = NULL;                           \
+        __fluent_libc_hg_lock_init(&guard->__lock);         \
+        __fluent_libc_hg_lock_init(&guard->__seq);          \
+        __FLUENT_LIBC_HG_RW_INIT_##RW(guard)                \
+                                                            \
+        if (is_concurrent)                                  \
+        {                                                   \
+            atomic_size_init(&guard->concurrent_ref, 1);    \
+        }                                                   \
+                                                            \
+        node->guard = guard;                                \
+        __fluent_libc_hp_##NAME##_track(node);              \
+                                                            \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+                                                            \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+                                                            \
+    static inline heap_guard_##NAME##_t *heap_##NAME##_alloc( \
+        const int is_concurrent,                            \
+        const int insertion_concurrent,                     \
+        const heap_##NAME##_destructor_t destructor,        \
+        V *default_ptr                                      \
+    )                                                       \
+    {                                                       \
+        return __fluent_libc_hp_##NAME##_alloc_guard(       \
+            is_concurrent,                                  \
+            insertion_concurrent,                           \
+            destructor,                                     \
+            default_ptr,                                    \
+            default_ptr ? HEAP_GUARD_ORIGIN_EXTERNAL        \
+                : __fluent_libc_hp_##NAME##_inline() ? HEAP_GUARD_ORIGIN_INLINE : HEAP_GUARD_ORIGIN_POOL, \
+            1                                               \
+        );                                                  \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *heap_##NAME##_alloc_array( \
+        const size_t count,                                 \
+        const int is_concurrent,                            \
+        const int insertion_concurrent,                     \
+        const heap_##NAME##_destructor_t destructor         \
+    )                                                       \
+    {                                                       \
+        if (count <= 1)                                     \
+        {                                                   \
+            return heap_##NAME##_alloc(is_concurrent, insertion_concurrent, destructor, NULL); \
+        }                                                   \
+                                                            \
+        if (count > SIZE_MAX / sizeof(V))                   \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        /* Mapped outside the registry mutex, only the bookkeeping needs it */ \
+        const size_t bytes = count * sizeof(V);             \
+        V *payload = (V *)__fluent_libc_hg_large_alloc(bytes, __fluent_libc_hp_##NAME##_align()); \
+        if (payload == NULL)                                \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        const int origin = __fluent_libc_hg_large_origin(bytes); \
+        heap_guard_##NAME##_t *guard = __fluent_libc_hp_##NAME##_alloc_guard( \
+            is_concurrent,                                  \
+            insertion_concurrent,                           \
+            destructor,                                     \
+            payload,                                        \
+            origin,                                         \
+            count                                           \
+        );                                                  \
+                                                            \
+        if (guard == NULL)                                  \
+        {                                                   \
+            __fluent_libc_hg_large_free(payload, bytes, origin); \
+        }                                                   \
+                                                            \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *heap_##NAME##_adopt( \
+        V *ptr,                                             \
+        const size_t count,                                 \
+        const heap_guard_releaser_t *releaser,              \
+        const int is_concurrent,                            \
+        const int insertion_concurrent,                     \
+        const heap_##NAME##_destructor_t destructor         \
+    )                                                       \
+    {                                                       \
+        if (ptr == NULL || count == 0 || releaser == NULL)  \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        /* On failure the caller still owns the buffer */   \
+        heap_guard_##NAME##_t *guard = __fluent_libc_hp_##NAME##_alloc_guard( \
+            is_concurrent,                                  \
+            insertion_concurrent,                           \
+            destructor,                                     \
+            ptr,                                            \
+            HEAP_GUARD_ORIGIN_ADOPTED,                      \
+            count                                           \
+        );                                                  \
+                                                            \
+        if (guard != NULL)                                  \
+        {                                                   \
+            guard->__releaser = releaser;                   \
+        }                                                   \
+                                                            \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline int extend_guard_##NAME(                  \
+        heap_guard_##NAME##_t *guard,                       \
+        const size_t count,                                 \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        if (count <= guard->allocated)                      \
+        {                                                   \
+            return 0;                                       \
+        }                                                   \
+                                                            \
+        if (                                                \
+            guard->__origin == HEAP_GUARD_ORIGIN_EXTERNAL ||  \
+            guard->__origin == HEAP_GUARD_ORIGIN_ADOPTED ||   \
+            count > SIZE_MAX / sizeof(V)                    \
+        )                                                   \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = insertion_concurrent ? __fluent_libc_impl_hg_##NAME##_mutex : NULL; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+        }                                                   \
+                                                            \
+        const size_t old_bytes = guard->allocated * sizeof(V); \
+        const size_t new_bytes = count * sizeof(V);         \
+        const int origin = __fluent_libc_hg_large_origin(new_bytes); \
+        const size_t old_charge = __fluent_libc_hp_##NAME##_charge(guard->__origin, guard->allocated); \
+        const size_t new_charge = __fluent_libc_hp_##NAME##_charge(origin, count); \
+                                                            \
+        /* Moving a padded slot into a tight array can shrink the charge */ \
+        const size_t extra = new_charge > old_charge ? new_charge - old_charge : 0; \
+                                                            \
+        int status = -1;                                    \
+        if (__fluent_libc_hp_##NAME##_reserve(mutex, extra) == 0) \
+        {                                                   \
+            V *grown = NULL;                                \
+            if (guard->__origin == HEAP_GUARD_ORIGIN_POOL || guard->__origin == HEAP_GUARD_ORIGIN_INLINE) \
+            {                                               \
+                /* Leaves the slab for good, the slot is handed back */ \
+                grown = (V *)__fluent_libc_hg_large_alloc(new_bytes, __fluent_libc_hp_##NAME##_align()); \
+                if (grown != NULL)                          \
+                {                                           \
+                    memcpy(grown, guard->ptr, sizeof(V));   \
+                    if (guard->__origin == HEAP_GUARD_ORIGIN_POOL) \
+                    {                                       \
+                        __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_val_slab, guard->ptr); \
+                    }                                       \
+                }                                           \
+            }                                               \
+            else                                            \
+            {                                               \
+                grown = (V *)__fluent_libc_hg_large_grow(guard->ptr, old_bytes, new_bytes, __fluent_libc_hp_##NAME##_align(), guard->__origin); \
+            }                                               \
+                                                            \
+            if (grown != NULL)                              \
+            {                                               \
+                guard->ptr = grown;                         \
+                guard->__origin = origin;                   \
+                guard->allocated = count;                   \
+                __fluent_libc_hg_##NAME##_usage -= old_charge + extra - new_charge; \
+                status = 0;                                 \
+            }                                               \
+            else                                            \
+            {                                               \
+                __fluent_libc_hg_##NAME##_usage -= extra;   \
+            }                                               \
+        }                                                   \
+                                                            \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+                                                            \
+        return status;                                      \
+    }                                                       \
+    static inline void raise_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        if (guard->concurrent)                              \
+        {                                                   \
+            /* Immortal counts are only read, their line stays shared */ \
+            if (atomic_size_load(&guard->concurrent_ref) < HEAP_GUARD_IMMORTAL_FLOOR) \
+            {                                               \
+                atomic_size_fetch_add(&guard->concurrent_ref, 1); \
+            }                                               \
+        }                                                   \
+        else if (guard->ref_count < HEAP_GUARD_IMMORTAL_FLOOR) \
+        {                                                   \
+            guard->ref_count++;                             \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_make_immortal(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        /* The caller's reference keeps the guard alive until the store */ \
+        if (guard->concurrent)                              \
+        {                                                   \
+            atomic_size_store(&guard->concurrent_ref, HEAP_GUARD_IMMORTAL); \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            guard->ref_count = HEAP_GUARD_IMMORTAL;         \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_promote(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        /* Owning thread only, before the guard reaches another one */ \
+        if (!guard->concurrent)                             \
+        {                                                   \
+            atomic_size_init(&guard->concurrent_ref, guard->ref_count); \
+            guard->concurrent = 1;                          \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *share_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        /* Atomic counts from here on, plus the receiver's reference */ \
+        __fluent_libc_hp_##NAME##_promote(guard);           \
+        raise_guard_##NAME(guard);                          \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline void lock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_lock_acquire(&guard->__lock);      \
+    }                                                       \
+                                                            \
+    static inline int trylock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        return __fluent_libc_hg_lock_try(&guard->__lock);   \
+    }                                                       \
+                                                            \
+    static inline void unlock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_lock_release(&guard->__lock);      \
+    }                                                       \
+                                                            \
+    static inline void write_begin_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_lock_acquire(&guard->__lock);      \
+        __fluent_libc_hg_seq_write_begin(&guard->__seq);    \
+    }                                                       \
+                                                            \
+    static inline void write_end_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_seq_write_end(&guard->__seq);      \
+        __fluent_libc_hg_lock_release(&guard->__lock);      \
+    }                                                       \
+                                                            \
+    static inline void write_guard_##NAME(heap_guard_##NAME##_t *guard, const V *value) \
+    {                                                       \
+        write_begin_guard_##NAME(guard);                    \
+        memcpy(guard->ptr, value, sizeof(V));               \
+        write_end_guard_##NAME(guard);                      \
+    }                                                       \
+                                                            \
+    static inline void read_guard_##NAME(heap_guard_##NAME##_t *guard, V *copy_out) \
+    {                                                       \
+        /* Lock-free and write-free, retries while a writer overlaps */ \
+        uint32_t start;                                     \
+        do                                                  \
+        {                                                   \
+            start = __fluent_libc_hg_seq_read_begin(&guard->__seq); \
+            memcpy(copy_out, guard->ptr, sizeof(V));        \
+        } while (__fluent_libc_hg_seq_read_retry(&guard->__seq, start)); \
+    }                                                       \
+                                                            \
+    __FLUENT_LIBC_HG_RW_API_##RW(V, NAME)                   \
+                                                            \
+    static inline void lower_guard_##NAME(                  \
+        heap_guard_##NAME##_t **guard_ptr,                  \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        if (guard_ptr == NULL || *guard_ptr == NULL)        \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        heap_guard_##NAME##_t *guard = *guard_ptr;          \
+                                                            \
+        int free_memory = 0;                                \
+        if (guard->concurrent)                              \
+        {                                                   \
+            if (atomic_size_load(&guard->concurrent_ref) >= HEAP_GUARD_IMMORTAL_FLOOR) \
+            {                                               \
+                return;                                     \
+            }                                               \
+                                                            \
+            /* Only the thread that takes the count to zero may free */ \
+            free_memory = atomic_size_fetch_sub(&guard->concurrent_ref, 1) == 1; \
+        }                                                   \
+        else if (guard->ref_count >= HEAP_GUARD_IMMORTAL_FLOOR) \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            guard->ref_count--;                             \
+            free_memory = guard->ref_count == 0;            \
+        }                                                   \
+                                                            \
+        if (free_memory == 1)                               \
+        {                                                   \
+            mutex_t *mutex = insertion_concurrent ? __fluent_libc_impl_hg_##NAME##_mutex : NULL; \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_lock(mutex);                          \
+            }                                               \
+                                                            \
+            __fluent_libc_heap_##NAME##_tracker_t *tracker = (__fluent_libc_heap_##NAME##_tracker_t *)guard->__tracker; \
+            __fluent_libc_hp_##NAME##_untrack(tracker);     \
+            __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_tracker_slab, tracker); \
+                                                            \
+            __fluent_libc_hg_##NAME##_usage -= __fluent_libc_hp_##NAME##_charge(guard->__origin, guard->allocated); \
+            if (__fluent_libc_hg_##NAME##_limit != 0 &&     \
+                __fluent_libc_hg_##NAME##_limit_policy == HEAP_GUARD_LIMIT_BLOCK) \
+            {                                               \
+                __fluent_libc_hp_##NAME##_notify();         \
+            }                                               \
+                                                            \
+            drop_guard_##NAME(guard_ptr, 0);                \
+                                                            \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_unlock(mutex);                        \
+            }                                               \
+        }                                                   \
+    }                                                       \
+                                                            \
+                                                            \
+    typedef struct heap_slice_##NAME##_t                    \
+    {                                                       \
+        heap_guard_##NAME##_t *guard;                       \
+        size_t offset; /* in elements of V */               \
+        size_t length;                                      \
+    } heap_slice_##NAME##_t;                                \
+                                                            \
+    static inline int slice_guard_##NAME(                   \
+        heap_guard_##NAME##_t *guard,                       \
+        const size_t offset,                                \
+        const size_t length,                                \
+        heap_slice_##NAME##_t *out                          \
+    )                                                       \
+    {                                                       \
+        if (guard == NULL || offset > guard->allocated || length > guard->allocated - offset) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        /* One reference per slice keeps the parent payload alive */ \
+        raise_guard_##NAME(guard);                          \
+        out->guard = guard;                                 \
+        out->offset = offset;                               \
+        out->length = length;                               \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline int subslice_##NAME(                      \
+        const heap_slice_##NAME##_t *slice,                 \
+        const size_t offset,                                \
+        const size_t length,                                \
+        heap_slice_##NAME##_t *out                          \
+    )                                                       \
+    {                                                       \
+        if (offset > slice->length || length > slice->length - offset) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        return slice_guard_##NAME(slice->guard, slice->offset + offset, length, out); \
+    }                                                       \
+                                                            \
+    static inline V *heap_slice_##NAME##_data(const heap_slice_##NAME##_t *slice) \
+    {                                                       \
+        return slice->guard->ptr + slice->offset;           \
+    }                                                       \
+                                                            \
+    static inline void release_slice_##NAME(                \
+        heap_slice_##NAME##_t *slice,                       \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        lower_guard_##NAME(&slice->guard, insertion_concurrent); \
+        /* lower_guard only clears it on free, a second release would lower the parent again */ \
+        slice->guard = NULL;                                \
+        slice->offset = 0;                                  \
+        slice->length = 0;                                  \
+    }                                                       \
+                                                            \
+    __FLUENT_LIBC_HG_RCU_API(V, NAME)                       \
+    __FLUENT_LIBC_HG_SNAPSHOT_API(V, NAME)
+
+// ============= GUARD CACHE =============
+// Keyed cache of raised guards. The cache owns one reference
+// per entry; hits hand out another one, and eviction (CLOCK,
+// under one byte budget shared by all stripes) lowers the
+// cache's. Lookups only lock the key's stripe, so readers of
+// different keys rarely contend. Entries are promoted to
+// atomic counts on put, as hits may raise them on any thread.
+#ifndef HEAP_GUARD_CACHE_STRIPES
+#   define HEAP_GUARD_CACHE_STRIPES 16 // power of two
+#endif
+#define HEAP_GUARD_CACHE_LINE 64
+
+/**
+ * splitmix64 finalizer, spreads sequential keys over both the
+ * stripe bits and the slot bits.
+ */
+static inline uint64_t __fluent_libc_hg_mix64(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+#define DEFINE_HEAP_GUARD_CACHE(V, NAME) \
+    typedef struct guard_cache_##NAME##_entry_t             \
+    {                                                       \
+        uint64_t key;                                       \
+        uint64_t hash;                                      \
+        heap_guard_##NAME##_t *guard; /* NULL marks a free slot */ \
+        size_t bytes;                                       \
+        int referenced;                                     \
+    } guard_cache_##NAME##_entry_t;                         \
+                                                            \
+    typedef struct guard_cache_##NAME##_stripe_t            \
+    {                                                       \
+        _Alignas(HEAP_GUARD_CACHE_LINE) mutex_t lock;       \
+        guard_cache_##NAME##_entry_t *slots;                \
+        size_t mask;                                        \
+        size_t count;                                       \
+        size_t hand;                                        \
+        size_t hits;                                        \
+        size_t misses;                                      \
+        size_t evictions;                                   \
+    } guard_cache_##NAME##_stripe_t;                        \
+                                                            \
+    typedef struct guard_cache_##NAME##_t                   \
+    {                                                       \
+        guard_cache_##NAME##_stripe_t stripes[HEAP_GUARD_CACHE_STRIPES]; \
+        size_t budget; /* 0 = unlimited */                  \
+        atomic_size_t bytes;                                \
+        int insertion_concurrent;                           \
+        atomic_size_t cursor;                               \
+    } guard_cache_##NAME##_t;                               \
+                                                            \
+    static inline guard_cache_##NAME##_stripe_t *__fluent_libc_gc_##NAME##_stripe( \
+        guard_cache_##NAME##_t *cache,                      \
+        const uint64_t hash                                 \
+    )                                                       \
+    {                                                       \
+        return &cache->stripes[hash & (HEAP_GUARD_CACHE_STRIPES - 1)]; \
+    }                                                       \
+                                                            \
+    static inline size_t __fluent_libc_gc_##NAME##_find(    \
+        const guard_cache_##NAME##_stripe_t *stripe,        \
+        const uint64_t key,                                 \
+        const uint64_t hash                                 \
+    )                                                       \
+    {                                                       \
+        for (size_t i = (hash >> 16) & stripe->mask;; i = (i + 1) & stripe->mask) \
+        {                                                   \
+            const guard_cache_##NAME##_entry_t *entry = &stripe->slots[i]; \
+            if (entry->guard == NULL)                       \
+            {                                               \
+                return SIZE_MAX;                            \
+            }                                               \
+                                                            \
+            if (entry->key == key)                          \
+            {                                               \
+                return i;                                   \
+            }                                               \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_gc_##NAME##_remove_at( \
+        guard_cache_##NAME##_t *cache,                      \
+        guard_cache_##NAME##_stripe_t *stripe,              \
+        size_t hole                                         \
+    )                                                       \
+    {                                                       \
+        /* Backward-shift deletion keeps probe chains tombstone-free */ \
+        atomic_size_fetch_sub(&cache->bytes, stripe->slots[hole].bytes); \
+        stripe->count--;                                    \
+                                                            \
+        for (size_t next = (hole + 1) & stripe->mask;; next = (next + 1) & stripe->mask) \
+        {                                                   \
+            stripe->slots[hole].guard = NULL;               \
+            if (stripe->slots[next].guard == NULL)          \
+            {                                               \
+                return;                                     \
+            }                                               \
+                                                            \
+            const size_t home = (stripe->slots[next].hash >> 16) & stripe->mask; \
+            if (((next - home) & stripe->mask) >= ((next - hole) & stripe->mask)) \
+            {                                               \
+                stripe->slots[hole] = stripe->slots[next];  \
+                hole = next;                                \
+            }                                               \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *__fluent_libc_gc_##NAME##_evict_one( \
+        guard_cache_##NAME##_t *cache,                      \
+        guard_cache_##NAME##_stripe_t *stripe,              \
+        size_t *bytes                                       \
+    )                                                       \
+    {                                                       \
+        /* CLOCK: a referenced entry gets a second pass, two sweeps always find a victim */ \
+        for (size_t step = 0; stripe->count != 0 && step <= 2 * stripe->mask + 1; step++) \
+        {                                                   \
+            const size_t i = stripe->hand;                  \
+            guard_cache_##NAME##_entry_t *entry = &stripe->slots[i]; \
+            stripe->hand = (i + 1) & stripe->mask;          \
+                                                            \
+            if (entry->guard == NULL)                       \
+            {                                               \
+                continue;                                   \
+            }                                               \
+                                                            \
+            if (entry->referenced)                          \
+            {                                               \
+                entry->referenced = 0;                      \
+                continue;                                   \
+            }                                               \
+                                                            \
+            heap_guard_##NAME##_t *victim = entry->guard;   \
+            *bytes = entry->bytes;                          \
+            __fluent_libc_gc_##NAME##_remove_at(cache, stripe, i); \
+            stripe->evictions++;                            \
+            return victim;                                  \
+        }                                                   \
+                                                            \
+        return NULL;                                        \
+    }                                                       \
+                                                            \
+    static inline int guard_cache_##NAME##_init(            \
+        guard_cache_##NAME##_t *cache,                      \
+        const size_t budget,                                \
+        const size_t capacity,                              \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        /* Slots stay under 3/4 full, sized for `capacity` entries across all stripes */ \
+        size_t slots = 8;                                   \
+        while (slots * 3 / 4 < capacity / HEAP_GUARD_CACHE_STRIPES + 1) \
+        {                                                   \
+            slots <<= 1;                                    \
+        }                                                   \
+                                                            \
+        for (size_t i = 0; i < HEAP_GUARD_CACHE_STRIPES; i++) \
+        {                                                   \
+            guard_cache_##NAME##_stripe_t *stripe = &cache->stripes[i]; \
+            stripe->slots = (guard_cache_##NAME##_entry_t *)calloc(slots, sizeof(guard_cache_##NAME##_entry_t)); \
+            if (stripe->slots == NULL)                      \
+            {                                               \
+                while (i-- > 0)                             \
+                {                                           \
+                    mutex_destroy(&cache->stripes[i].lock); \
+                    free(cache->stripes[i].slots);          \
+                }                                           \
+                                                            \
+                return -1;                                  \
+            }                                               \
+                                                            \
+            mutex_init(&stripe->lock);                      \
+            stripe->mask = slots - 1;                       \
+            stripe->count = 0;                              \
+            stripe->hand = 0;                               \
+            stripe->hits = 0;                               \
+            stripe->misses = 0;                             \
+            stripe->evictions = 0;                          \
+        }                                                   \
+                                                            \
+        cache->budget = budget;                             \
+        atomic_size_init(&cache->bytes, 0);                 \
+        cache->insertion_concurrent = insertion_concurrent; \
+        atomic_size_init(&cache->cursor, 0);                \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline size_t guard_cache_##NAME##_evict(        \
+        guard_cache_##NAME##_t *cache,                      \
+        const size_t bytes                                  \
+    )                                                       \
+    {                                                       \
+        size_t released = 0;                                \
+        size_t empty = 0;                                   \
+                                                            \
+        /* Round-robin so pressure doesn't always land on the same stripe */ \
+        while (released < bytes && empty < HEAP_GUARD_CACHE_STRIPES) \
+        {                                                   \
+            const size_t s = atomic_size_fetch_add(&cache->cursor, 1) & (HEAP_GUARD_CACHE_STRIPES - 1); \
+            guard_cache_##NAME##_stripe_t *stripe = &cache->stripes[s]; \
+            size_t freed = 0;                               \
+                                                            \
+            mutex_lock(&stripe->lock);                      \
+            heap_guard_##NAME##_t *victim = __fluent_libc_gc_##NAME##_evict_one(cache, stripe, &freed); \
+            mutex_unlock(&stripe->lock);                    \
+                                                            \
+            if (victim == NULL)                             \
+            {                                               \
+                empty++;                                    \
+                continue;                                   \
+            }                                               \
+                                                            \
+            empty = 0;                                      \
+            released += freed;                              \
+            lower_guard_##NAME(&victim, cache->insertion_concurrent); \
+        }                                                   \
+                                                            \
+        return released;                                    \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *guard_cache_##NAME##_get( \
+        guard_cache_##NAME##_t *cache,                      \
+        const uint64_t key                                  \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        guard_cache_##NAME##_stripe_t *stripe = __fluent_libc_gc_##NAME##_stripe(cache, hash); \
+        heap_guard_##NAME##_t *guard = NULL;                \
+                                                            \
+        mutex_lock(&stripe->lock);                          \
+        const size_t i = __fluent_libc_gc_##NAME##_find(stripe, key, hash); \
+        if (i != SIZE_MAX)                                  \
+        {                                                   \
+            /* Raised under the stripe lock, an eviction can't lower it first */ \
+            guard = stripe->slots[i].guard;                 \
+            stripe->slots[i].referenced = 1;                \
+            raise_guard_##NAME(guard);                      \
+            stripe->hits++;                                 \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            stripe->misses++;                               \
+        }                                                   \
+        mutex_unlock(&stripe->lock);                        \
+                                                            \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline int guard_cache_##NAME##_put(             \
+        guard_cache_##NAME##_t *cache,                      \
+        const uint64_t key,                                 \
+        heap_guard_##NAME##_t *guard                        \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        guard_cache_##NAME##_stripe_t *stripe = __fluent_libc_gc_##NAME##_stripe(cache, hash); \
+        const size_t bytes = __fluent_libc_hp_##NAME##_charge(guard->__origin, guard->allocated); \
+                                                            \
+        if (cache->budget != 0 && bytes > cache->budget)    \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        __fluent_libc_hp_##NAME##_promote(guard);           \
+        raise_guard_##NAME(guard);                          \
+                                                            \
+        for (;;)                                            \
+        {                                                   \
+            heap_guard_##NAME##_t *victim = NULL;           \
+            size_t freed = 0;                               \
+                                                            \
+            mutex_lock(&stripe->lock);                      \
+            const size_t i = __fluent_libc_gc_##NAME##_find(stripe, key, hash); \
+            if (i != SIZE_MAX)                              \
+            {                                               \
+                guard_cache_##NAME##_entry_t *entry = &stripe->slots[i]; \
+                victim = entry->guard;                      \
+                atomic_size_fetch_add(&cache->bytes, bytes); \
+                atomic_size_fetch_sub(&cache->bytes, entry->bytes); \
+                entry->guard = guard;                       \
+                entry->bytes = bytes;                       \
+                entry->referenced = 1;                      \
+                mutex_unlock(&stripe->lock);                \
+                                                            \
+                lower_guard_##NAME(&victim, cache->insertion_concurrent); \
+                                                            \
+                /* A larger payload may have pushed the total over */ \
+                const size_t total = atomic_size_load(&cache->bytes); \
+                if (cache->budget != 0 && total > cache->budget) \
+                {                                           \
+                    guard_cache_##NAME##_evict(cache, total - cache->budget); \
+                }                                           \
+                                                            \
+                return 0;                                   \
+            }                                               \
+                                                            \
+            if ((stripe->count + 1) * 4 > (stripe->mask + 1) * 3) \
+            {                                               \
+                victim = __fluent_libc_gc_##NAME##_evict_one(cache, stripe, &freed); \
+                mutex_unlock(&stripe->lock);                \
+                                                            \
+                /* Lowered outside the stripe lock, it may take the registry mutex */ \
+                lower_guard_##NAME(&victim, cache->insertion_concurrent); \
+                continue;                                   \
+            }                                               \
+                                                            \
+            /* Reserved under the stripe lock, so concurrent puts can't overshoot together */ \
+            const size_t total = atomic_size_fetch_add(&cache->bytes, bytes) + bytes; \
+            if (cache->budget != 0 && total > cache->budget) \
+            {                                               \
+                atomic_size_fetch_sub(&cache->bytes, bytes); \
+                mutex_unlock(&stripe->lock);                \
+                                                            \
+                /* The budget is shared, the victims may sit in any stripe */ \
+                if (guard_cache_##NAME##_evict(cache, total - cache->budget) == 0) \
+                {                                           \
+                    __fluent_libc_hg_yield();               \
+                }                                           \
+                continue;                                   \
+            }                                               \
+                                                            \
+            size_t slot = (hash >> 16) & stripe->mask;      \
+            while (stripe->slots[slot].guard != NULL)       \
+            {                                               \
+                slot = (slot + 1) & stripe->mask;           \
+            }                                               \
+                                                            \
+            guard_cache_##NAME##_entry_t *entry = &stripe->slots[slot]; \
+            entry->key = key;                               \
+            entry->hash = hash;                             \
+            entry->guard = guard;                           \
+            entry->bytes = bytes;                           \
+            entry->referenced = 0;                          \
+            stripe->count++;                                \
+            mutex_unlock(&stripe->lock);                    \
+            return 0;                                       \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline int guard_cache_##NAME##_remove(          \
+        guard_cache_##NAME##_t *cache,                      \
+        const uint64_t key                                  \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        guard_cache_##NAME##_stripe_t *stripe = __fluent_libc_gc_##NAME##_stripe(cache, hash); \
+        heap_guard_##NAME##_t *guard = NULL;                \
+                                                            \
+        mutex_lock(&stripe->lock);                          \
+        const size_t i = __fluent_libc_gc_##NAME##_find(stripe, key, hash); \
+        if (i != SIZE_MAX)                                  \
+        {                                                   \
+            guard = stripe->slots[i].guard;                 \
+            __fluent_libc_gc_##NAME##_remove_at(cache, stripe, i); \
+        }                                                   \
+        mutex_unlock(&stripe->lock);                        \
+                                                            \
+        if (guard == NULL)                                  \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        lower_guard_##NAME(&guard, cache->insertion_concurrent); \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline size_t guard_cache_##NAME##_reclaim(const size_t needed, void *ctx) \
+    {                                                       \
+        return guard_cache_##NAME##_evict((guard_cache_##NAME##_t *)ctx, needed); \
+    }                                                       \
+                                                            \
+    static inline size_t guard_cache_##NAME##_size(guard_cache_##NAME##_t *cache) \
+    {                                                       \
+        size_t count = 0;                                   \
+        for (size_t i = 0; i < HEAP_GUARD_CACHE_STRIPES; i++) \
+        {                                                   \
+            mutex_lock(&cache->stripes[i].lock);            \
+            count += cache->stripes[i].count;               \
+            mutex_unlock(&cache->stripes[i].lock);          \
+        }                                                   \
+                                                            \
+        return count;                                       \
+    }                                                       \
+                                                            \
+    static inline void guard_cache_##NAME##_stats(          \
+        guard_cache_##NAME##_t *cache,                      \
+        size_t *hits,                                       \
+        size_t *misses,                                     \
+        size_t *evictions                                   \
+    )                                                       \
+    {                                                       \
+        *hits = *misses = *evictions = 0;                   \
+        for (size_t i = 0; i < HEAP_GUARD_CACHE_STRIPES; i++) \
+        {                                                   \
+            guard_cache_##NAME##_stripe_t *stripe = &cache->stripes[i]; \
+            mutex_lock(&stripe->lock);                      \
+            *hits += stripe->hits;                          \
+            *misses += stripe->misses;                      \
+            *evictions += stripe->evictions;                \
+            mutex_unlock(&stripe->lock);                    \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void guard_cache_##NAME##_destroy(guard_cache_##NAME##_t *cache) \
+    {                                                       \
+        guard_cache_##NAME##_evict(cache, SIZE_MAX);        \
+                                                            \
+        for (size_t i = 0; i < HEAP_GUARD_CACHE_STRIPES; i++) \
+        {                                                   \
+            mutex_destroy(&cache->stripes[i].lock);         \
+            free(cache->stripes[i].slots);                  \
+            cache->stripes[i].slots = NULL;                 \
+        }                                                   \
+    }
+
+
+// ============= EPOCHS =============
+// Epoch-based reclamation shared by the lock-free structures
+// below. Readers bracket their accesses with enter()/exit();
+// memory unlinked by writers is retired and only reclaimed once
+// every thread inside a critical section at the time has left
+// it, two epoch advances later. A thread holds a record only
+// while inside its outermost critical section, so any number of
+// threads can use the epochs as long as no more than
+// HEAP_GUARD_EPOCH_THREADS are inside at the same time.
+#ifndef _WIN32
+
+#ifndef HEAP_GUARD_EPOCH_THREADS
+#   define HEAP_GUARD_EPOCH_THREADS 256 // threads inside a critical section at once, more wait
+#endif
+#define HEAP_GUARD_EPOCH_COLLECT 64    // retirements between collection attempts
+
+/**
+ * Header embedded in retired objects, so retiring never has
+ * to allocate. `reclaim` receives the header back.
+ */
+typedef struct heap_guard_retired_t
+{
+    void (*reclaim)(struct heap_guard_retired_t *retired);
+    uint64_t epoch;
+    struct heap_guard_retired_t *next;
+} heap_guard_retired_t;
+
+typedef struct __fluent_libc_hg_epoch_record_t
+{
+    _Alignas(HEAP_GUARD_CACHE_LINE) _Atomic uint64_t epoch; // 0 while quiescent
+    _Atomic int in_use;
+} __fluent_libc_hg_epoch_record_t;
+
+typedef struct __fluent_libc_hg_epoch_t
+{
+    _Atomic uint64_t global;
+    __fluent_libc_hg_epoch_record_t records[HEAP_GUARD_EPOCH_THREADS];
+    pthread_mutex_t lock;
+    heap_guard_retired_t *retired;
+    size_t retired_count;
+} __fluent_libc_hg_epoch_t;
+
+typedef struct __fluent_libc_hg_epoch_local_t
+{
+    __fluent_libc_hg_epoch_record_t *record; // NULL outside a critical section
+    __fluent_libc_hg_epoch_record_t *last;   // tried first on the next claim
+    size_t depth;
+} __fluent_libc_hg_epoch_local_t;
+
+#ifdef HEAP_GUARD_IMPLEMENTATION
+__fluent_libc_hg_epoch_t __fluent_libc_hg_epoch = {
+    .global = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+_Thread_local __fluent_libc_hg_epoch_local_t __fluent_libc_hg_epoch_thread;
+pthread_once_t __fluent_libc_hg_epoch_once = PTHREAD_ONCE_INIT;
+#else
+extern __fluent_libc_hg_epoch_t __fluent_libc_hg_epoch;
+extern _Thread_local __fluent_libc_hg_epoch_local_t __fluent_libc_hg_epoch_thread;
+extern pthread_once_t __fluent_libc_hg_epoch_once;
+#endif
+
+static inline __fluent_libc_hg_epoch_t *__fluent_libc_hg_epoch_state()
+{
+    return &__fluent_libc_hg_epoch;
+}
+
+static inline __fluent_libc_hg_epoch_local_t *__fluent_libc_hg_epoch_local()
+{
+    return &__fluent_libc_hg_epoch_thread;
+}
+
+static inline void __fluent_libc_hg_epoch_release(void *record)
+{
+    atomic_store_explicit(&((__fluent_libc_hg_epoch_record_t *)record)->epoch, 0, memory_order_release);
+    atomic_store_explicit(&((__fluent_libc_hg_epoch_record_t *)record)->in_use, 0, memory_order_release);
+}
+
+static inline void __fluent_libc_hg_epoch_atfork_child()
+{
+    // Only the forking thread survives, every other record is stale
+    __fluent_libc_hg_epoch_t *state = __fluent_libc_hg_epoch_state();
+    const __fluent_libc_hg_epoch_record_t *own = __fluent_libc_hg_epoch_local()->record;
+    pthread_mutex_init(&state->lock, NULL);
+
+    for (size_t i = 0; i < HEAP_GUARD_EPOCH_THREADS; i++)
+    {
+        if (&state->records[i] != own)
+        {
+            __fluent_libc_hg_epoch_release(&state->records[i]);
+        }
+    }
+}
+
+static inline void __fluent_libc_hg_epoch_setup()
+{
+    pthread_atfork(NULL, NULL, __fluent_libc_hg_epoch_atfork_child);
+}
+
+static inline int __fluent_libc_hg_epoch_try(__fluent_libc_hg_epoch_record_t *record)
+{
+    int expected = 0;
+    return atomic_load_explicit(&record->in_use, memory_order_relaxed) == 0 &&
+        atomic_compare_exchange_strong(&record->in_use, &expected, 1);
+}
+
+static inline __fluent_libc_hg_epoch_record_t *__fluent_libc_hg_epoch_claim(
+    __fluent_libc_hg_epoch_local_t *local
+)
+{
+    // The record this thread had last is usually still free,
+    // and its cache line is likely still local
+    if (local->last != NULL && __fluent_libc_hg_epoch_try(local->last))
+    {
+        return local->last;
+    }
+
+    pthread_once(&__fluent_libc_hg_epoch_once, __fluent_libc_hg_epoch_setup);
+
+    __fluent_libc_hg_epoch_t *state = __fluent_libc_hg_epoch_state();
+    for (;;)
+    {
+        for (size_t i = 0; i < HEAP_GUARD_EPOCH_THREADS; i++)
+        {
+            if (__fluent_libc_hg_epoch_try(&state->records[i]))
+            {
+                local->last = &state->records[i];
+                return &state->records[i];
+            }
+        }
+
+        // Every record is taken, wait for a thread to leave its
+        // critical section
+        __fluent_libc_hg_yield();
+    }
+}
+
+static inline void heap_guard_epoch_enter()
+{
+    __fluent_libc_hg_epoch_local_t *local = __fluent_libc_hg_epoch_local();
+    if (local->depth++ != 0)
+    {
+        return;
+    }
+
+    local->record = __fluent_libc_hg_epoch_claim(local);
+
+    // Published before any shared pointer is read
+    const uint64_t epoch = atomic_load_explicit(&__fluent_libc_hg_epoch_state()->global, memory_order_relaxed);
+    atomic_store_explicit(&local->record->epoch, epoch, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void heap_guard_epoch_exit()
+{
+    __fluent_libc_hg_epoch_local_t *local = __fluent_libc_hg_epoch_local();
+    if (--local->depth == 0)
+    {
+        // Handed back right away, a thread outside any critical
+        // section holds no record
+        __fluent_libc_hg_epoch_release(local->record);
+        local->record = NULL;
+    }
+}
+
+/**
+ * Moves the global epoch forward if every active reader has
+ * observed the current one. Returns the global epoch after.
+ */
+static inline uint64_t __fluent_libc_hg_epoch_advance()
+{
+    __fluent_libc_hg_epoch_t *state = __fluent_libc_hg_epoch_state();
+    uint64_t epoch = atomic_load_explicit(&state->global, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (size_t i = 0; i < HEAP_GUARD_EPOCH_THREADS; i++)
+    {
+        const uint64_t seen = atomic_load_explicit(&state->records[i].epoch, memory_order_acquire);
+        if (seen != 0 && seen != epoch)
+        {
+            return epoch;
+        }
+    }
+
+    if (atomic_compare_exchange_strong(&state->global, &epoch, epoch + 1))
+    {
+        return epoch + 1;
+    }
+
+    return epoch;
+}
+
+/**
+ * Reclaims every retired object that is two epochs old. The
+ * callbacks run outside the retire lock and may retire more.
+ */
+static inline void heap_guard_epoch_collect()
+{
+    __fluent_libc_hg_epoch_t *state = __fluent_libc_hg_epoch_state();
+    const uint64_t epoch = __fluent_libc_hg_epoch_advance();
+    heap_guard_retired_t *ready = NULL;
+
+    pthread_mutex_lock(&state->lock);
+    heap_guard_retired_t **link = &state->retired;
+    while (*link != NULL)
+    {
+        heap_guard_retired_t *retired = *link;
+        if (retired->epoch + 2 <= epoch)
+        {
+            *link = retired->next;
+            retired->next = ready;
+            ready = retired;
+            state->retired_count--;
+        }
+        else
+        {
+            link = &retired->next;
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    while (ready != NULL)
+    {
+        heap_guard_retired_t *next = ready->next;
+        ready->reclaim(ready);
+        ready = next;
+    }
+}
+
+static inline void heap_guard_epoch_retire(
+    heap_guard_retired_t *retired,
+    void (*reclaim)(heap_guard_retired_t *retired)
+)
+{
+    __fluent_libc_hg_epoch_t *state = __fluent_libc_hg_epoch_state();
+    retired->reclaim = reclaim;
+
+    pthread_mutex_lock(&state->lock);
+    retired->epoch = atomic_load_explicit(&state->global, memory_order_acquire);
+    retired->next = state->retired;
+    state->retired = retired;
+    const size_t pending = ++state->retired_count;
+    pthread_mutex_unlock(&state->lock);
+
+    if (pending % HEAP_GUARD_EPOCH_COLLECT == 0)
+    {
+        heap_guard_epoch_collect();
+    }
+}
+
+/**
+ * Waits for a full grace period and reclaims everything
+ * retired before the call. Must not be called from inside a
+ * critical section, it would wait on itself.
+ */
+static inline void heap_guard_epoch_synchronize()
+{
+    const uint64_t target = atomic_load_explicit(&__fluent_libc_hg_epoch_state()->global, memory_order_acquire) + 2;
+    while (__fluent_libc_hg_epoch_advance() < target)
+    {
+        __fluent_libc_hg_yield();
+    }
+
+    heap_guard_epoch_collect();
+}
+
+#endif // _WIN32
+
+// ============= PAYLOAD REPLACEMENT =============
+// RCU-style updates of a guard's payload. Writers (serialized by
+// the guard lock) build the new payload off to the side, publish
+// pointer and length together under the guard's sequence word and
+// retire the old payload through the epochs above, so readers
+// inside heap_guard_epoch_enter()/exit() never block and never
+// see freed memory. read_guard() is not epoch-protected and must
+// not be mixed with replacement. A payload that came from the
+// pool's slab is handed back to it later, from whichever thread
+// runs the collection, so replacing one fails with -1 unless the
+// type has made an insertion_concurrent allocation: a pool that
+// never takes its lock would see its slab touched behind its back.
+#ifndef _WIN32
+
+#define __FLUENT_LIBC_HG_RCU_API(V, NAME) \
+    typedef struct __fluent_libc_hg_##NAME##_retired_t      \
+    {                                                       \
+        heap_guard_retired_t retired; /* first, the epoch hands it back */ \
+        V *ptr;                                             \
+        size_t count;                                       \
+        int origin;                                         \
+        const heap_guard_releaser_t *releaser;              \
+    } __fluent_libc_hg_##NAME##_retired_t;                  \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_rcu_reclaim(heap_guard_retired_t *retired) \
+    {                                                       \
+        __fluent_libc_hg_##NAME##_retired_t *old = (__fluent_libc_hg_##NAME##_retired_t *)retired; \
+        if (old->origin == HEAP_GUARD_ORIGIN_POOL)          \
+        {                                                   \
+            mutex_t *mutex = __fluent_libc_impl_hg_##NAME##_mutex; \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_lock(mutex);                          \
+            }                                               \
+                                                            \
+            /* A torn-down pool took its slots with it */   \
+            if (__fluent_libc_hg_##NAME##_slabs_ready)      \
+            {                                               \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_val_slab, old->ptr); \
+            }                                               \
+                                                            \
+            if (mutex != NULL)                              \
+            {                                               \
+                mutex_unlock(mutex);                        \
+            }                                               \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            __fluent_libc_hp_##NAME##_free_payload(old->ptr, old->count, old->origin, old->releaser); \
+        }                                                   \
+                                                            \
+        free(old);                                          \
+    }                                                       \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_publish(    \
+        heap_guard_##NAME##_t *guard,                       \
+        V *ptr,                                             \
+        const size_t count,                                 \
+        const int origin,                                   \
+        const heap_guard_releaser_t *releaser,              \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        /* The caller holds the guard lock */               \
+        __fluent_libc_hg_##NAME##_retired_t *old = (__fluent_libc_hg_##NAME##_retired_t *)malloc(sizeof(__fluent_libc_hg_##NAME##_retired_t)); \
+        if (old == NULL)                                    \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        const int pooled = guard->__origin == HEAP_GUARD_ORIGIN_POOL; \
+        mutex_t *mutex = insertion_concurrent || pooled ? __fluent_libc_impl_hg_##NAME##_mutex : NULL; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+        }                                                   \
+                                                            \
+        /* Pool slots go back from whichever thread collects, only a locked pool allows that */ \
+        int status = pooled && !__fluent_libc_hg_##NAME##_trim_registered ? -1 : 0; \
+        if (status == 0)                                    \
+        {                                                   \
+            const size_t old_charge = __fluent_libc_hp_##NAME##_charge(guard->__origin, guard->allocated); \
+            const size_t new_charge = __fluent_libc_hp_##NAME##_charge(origin, count); \
+            const size_t extra = new_charge > old_charge ? new_charge - old_charge : 0; \
+            status = __fluent_libc_hp_##NAME##_reserve(mutex, extra); \
+            if (status == 0)                                \
+            {                                               \
+                __fluent_libc_hg_##NAME##_usage -= old_charge + extra - new_charge; \
+            }                                               \
+        }                                                   \
+                                                            \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+                                                            \
+        if (status != 0)                                    \
+        {                                                   \
+            free(old);                                      \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        old->ptr = guard->ptr;                              \
+        old->count = guard->allocated;                      \
+        old->origin = guard->__origin;                      \
+        old->releaser = guard->__releaser;                  \
+                                                            \
+        /* Readers see the old pair or the new one, never a mix */ \
+        __fluent_libc_hg_seq_write_begin(&guard->__seq);    \
+        atomic_store_explicit((_Atomic(V *) *)&guard->ptr, ptr, memory_order_relaxed); \
+        atomic_store_explicit((_Atomic size_t *)&guard->allocated, count, memory_order_relaxed); \
+        __fluent_libc_hg_seq_write_end(&guard->__seq);      \
+        guard->__origin = origin;                           \
+        guard->__releaser = releaser;                       \
+                                                            \
+        if (old->ptr == NULL)                               \
+        {                                                   \
+            free(old);                                      \
+            return 0;                                       \
+        }                                                   \
+                                                            \
+        heap_guard_epoch_retire(&old->retired, __fluent_libc_hp_##NAME##_rcu_reclaim); \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline V *deref_guard_##NAME(heap_guard_##NAME##_t *guard, size_t *count) \
+    {                                                       \
+        /* Valid until the caller's heap_guard_epoch_exit() */ \
+        V *ptr;                                             \
+        size_t length;                                      \
+        uint32_t start;                                     \
+        do                                                  \
+        {                                                   \
+            start = __fluent_libc_hg_seq_read_begin(&guard->__seq); \
+            ptr = atomic_load_explicit((_Atomic(V *) *)&guard->ptr, memory_order_relaxed); \
+            length = atomic_load_explicit((_Atomic size_t *)&guard->allocated, memory_order_relaxed); \
+        } while (__fluent_libc_hg_seq_read_retry(&guard->__seq, start)); \
+                                                            \
+        if (count != NULL)                                  \
+        {                                                   \
+            *count = length;                                \
+        }                                                   \
+                                                            \
+        return ptr;                                         \
+    }                                                       \
+                                                            \
+    static inline int replace_payload_##NAME(               \
+        heap_guard_##NAME##_t *guard,                       \
+        V *new_ptr,                                         \
+        const size_t count,                                 \
+        const heap_guard_releaser_t *releaser,              \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        /* Without a releaser the guard never frees new_ptr */ \
+        if (new_ptr == NULL || count == 0)                  \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        const int origin = releaser != NULL ? HEAP_GUARD_ORIGIN_ADOPTED : HEAP_GUARD_ORIGIN_EXTERNAL; \
+        __fluent_libc_hg_lock_acquire(&guard->__lock);      \
+        const int status = __fluent_libc_hp_##NAME##_publish(guard, new_ptr, count, origin, releaser, insertion_concurrent); \
+        __fluent_libc_hg_lock_release(&guard->__lock);      \
+        return status;                                      \
+    }                                                       \
+                                                            \
+    static inline int extend_guard_rcu_##NAME(              \
+        heap_guard_##NAME##_t *guard,                       \
+        const size_t count,                                 \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        if (count > SIZE_MAX / sizeof(V))                   \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_lock_acquire(&guard->__lock);      \
+        if (count <= guard->allocated)                      \
+        {                                                   \
+            __fluent_libc_hg_lock_release(&guard->__lock);  \
+            return 0;                                       \
+        }                                                   \
+                                                            \
+        /* Always a copy, readers may still be walking the old array */ \
+        const size_t new_bytes = count * sizeof(V);         \
+        const int origin = __fluent_libc_hg_large_origin(new_bytes); \
+        V *grown = (V *)__fluent_libc_hg_large_alloc(new_bytes, __fluent_libc_hp_##NAME##_align()); \
+        int status = -1;                                    \
+        if (grown != NULL)                                  \
+        {                                                   \
+            if (guard->ptr != NULL)                         \
+            {                                               \
+                memcpy(grown, guard->ptr, guard->allocated * sizeof(V)); \
+            }                                               \
+                                                            \
+            status = __fluent_libc_hp_##NAME##_publish(guard, grown, count, origin, NULL, insertion_concurrent); \
+            if (status != 0)                                \
+            {                                               \
+                __fluent_libc_hg_large_free(grown, new_bytes, origin); \
+            }                                               \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_lock_release(&guard->__lock);      \
+        return status;                                      \
+    }
+
+#else
+#   define __FLUENT_LIBC_HG_RCU_API(V, NAME)
+#endif // _WIN32
+
+// ============= GUARD MAP =============
+// Concurrent open-addressing map from 64-bit ids to guards.
+// Slots point at immutable nodes, so lookups are lock-free:
+// they run inside an epoch and raise the guard they find.
+// Removal unlinks the node and retires it, lowering the map's
+// reference only after every reader that could still see it
+// has left. Writers lock a stripe chosen by the key, which
+// serializes writers of one key and nothing else. The table
+// does not grow; removed slots are reused by later inserts.
+// Once a quarter of the slots are tombstones, a writer takes
+// every stripe and rebuilds the table without them, publishing
+// the copy and retiring the old one, so misses stay short after
+// churn. Guards are promoted to atomic counts on insert.
+#ifndef _WIN32
+
+#ifndef HEAP_GUARD_MAP_STRIPES
+#   define HEAP_GUARD_MAP_STRIPES 64 // power of two
+#endif
+
+#define DEFINE_HEAP_GUARD_MAP(V, NAME) \
+    typedef struct guard_map_##NAME##_node_t                \
+    {                                                       \
+        heap_guard_retired_t retired; /* first, reclaim casts back */ \
+        uint64_t key;                                       \
+        heap_guard_##NAME##_t *guard;                       \
+        int insertion_concurrent;                           \
+    } guard_map_##NAME##_node_t;                            \
+                                                            \
+    typedef struct guard_map_##NAME##_table_t               \
+    {                                                       \
+        heap_guard_retired_t retired; /* first, reclaim casts back */ \
+        size_t mask;                                        \
+        _Atomic(guard_map_##NAME##_node_t *) slots[];       \
+    } guard_map_##NAME##_table_t;                           \
+                                                            \
+    typedef struct guard_map_##NAME##_t                     \
+    {                                                       \
+        _Atomic(guard_map_##NAME##_table_t *) table;        \
+        int insertion_concurrent;                           \
+        atomic_size_t count;                                \
+        atomic_size_t tombstones; /* in the current table */ \
+        guard_map_##NAME##_node_t tombstone;                \
+        mutex_t stripes[HEAP_GUARD_MAP_STRIPES];            \
+    } guard_map_##NAME##_t;                                 \
+                                                            \
+    static inline void __fluent_libc_gm_##NAME##_reclaim(heap_guard_retired_t *retired) \
+    {                                                       \
+        guard_map_##NAME##_node_t *node = (guard_map_##NAME##_node_t *)retired; \
+        lower_guard_##NAME(&node->guard, node->insertion_concurrent); \
+        free(node);                                         \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_gm_##NAME##_free_table(heap_guard_retired_t *retired) \
+    {                                                       \
+        free(retired);                                      \
+    }                                                       \
+                                                            \
+    static inline guard_map_##NAME##_table_t *__fluent_libc_gm_##NAME##_table(const size_t slots) \
+    {                                                       \
+        guard_map_##NAME##_table_t *table = (guard_map_##NAME##_table_t *)calloc( \
+            1,                                              \
+            sizeof(guard_map_##NAME##_table_t) + slots * sizeof(table->slots[0]) \
+        );                                                  \
+        if (table != NULL)                                  \
+        {                                                   \
+            table->mask = slots - 1;                        \
+        }                                                   \
+                                                            \
+        return table;                                       \
+    }                                                       \
+                                                            \
+    /**                                                     \
+     * Rebuilds the table without its tombstones. Every stripe \
+     * is held, so no writer is inside either table; readers \
+     * still scanning the old one keep it until they leave. \
+     */                                                     \
+    static inline void __fluent_libc_gm_##NAME##_rehash(guard_map_##NAME##_t *map) \
+    {                                                       \
+        for (size_t i = 0; i < HEAP_GUARD_MAP_STRIPES; i++) \
+        {                                                   \
+            mutex_lock(&map->stripes[i]);                   \
+        }                                                   \
+                                                            \
+        guard_map_##NAME##_table_t *old = atomic_load_explicit(&map->table, memory_order_relaxed); \
+        guard_map_##NAME##_table_t *fresh = NULL;           \
+                                                            \
+        /* Another writer may have rebuilt it while this one waited */ \
+        if (atomic_size_load(&map->tombstones) >= (old->mask + 1) / 4) \
+        {                                                   \
+            fresh = __fluent_libc_gm_##NAME##_table(old->mask + 1); \
+        }                                                   \
+                                                            \
+        if (fresh != NULL)                                  \
+        {                                                   \
+            for (size_t i = 0; i <= old->mask; i++)         \
+            {                                               \
+                guard_map_##NAME##_node_t *node = atomic_load_explicit(&old->slots[i], memory_order_relaxed); \
+                if (node == NULL || node == &map->tombstone) \
+                {                                           \
+                    continue;                               \
+                }                                           \
+                                                            \
+                size_t j = __fluent_libc_hg_mix64(node->key) & fresh->mask; \
+                while (atomic_load_explicit(&fresh->slots[j], memory_order_relaxed) != NULL) \
+                {                                           \
+                    j = (j + 1) & fresh->mask;              \
+                }                                           \
+                                                            \
+                atomic_store_explicit(&fresh->slots[j], node, memory_order_relaxed); \
+            }                                               \
+                                                            \
+            atomic_size_store(&map->tombstones, 0);         \
+            atomic_store_explicit(&map->table, fresh, memory_order_release); \
+        }                                                   \
+                                                            \
+        for (size_t i = HEAP_GUARD_MAP_STRIPES; i-- > 0;)   \
+        {                                                   \
+            mutex_unlock(&map->stripes[i]);                 \
+        }                                                   \
+                                                            \
+        if (fresh != NULL)                                  \
+        {                                                   \
+            heap_guard_epoch_retire(&old->retired, __fluent_libc_gm_##NAME##_free_table); \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline int guard_map_##NAME##_init(              \
+        guard_map_##NAME##_t *map,                          \
+        const size_t capacity,                              \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        /* Removed slots are reused, not freed, so keep headroom for probing */ \
+        size_t slots = 16;                                  \
+        while (slots * 3 / 4 < capacity + 1)                \
+        {                                                   \
+            slots <<= 1;                                    \
+        }                                                   \
+                                                            \
+        guard_map_##NAME##_table_t *table = __fluent_libc_gm_##NAME##_table(slots); \
+        if (table == NULL)                                  \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        atomic_init(&map->table, table);                    \
+        map->insertion_concurrent = insertion_concurrent;   \
+        atomic_size_init(&map->count, 0);                   \
+        atomic_size_init(&map->tombstones, 0);              \
+        for (size_t i = 0; i < HEAP_GUARD_MAP_STRIPES; i++) \
+        {                                                   \
+            mutex_init(&map->stripes[i]);                   \
+        }                                                   \
+                                                            \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *guard_map_##NAME##_get( \
+        guard_map_##NAME##_t *map,                          \
+        const uint64_t key                                  \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        heap_guard_##NAME##_t *guard = NULL;                \
+                                                            \
+        heap_guard_epoch_enter();                           \
+        guard_map_##NAME##_table_t *table = atomic_load_explicit(&map->table, memory_order_acquire); \
+        for (size_t step = 0, i = hash & table->mask; step <= table->mask; step++, i = (i + 1) & table->mask) \
+        {                                                   \
+            guard_map_##NAME##_node_t *node = atomic_load_explicit(&table->slots[i], memory_order_acquire); \
+            if (node == NULL)                               \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (node != &map->tombstone && node->key == key) \
+            {                                               \
+                /* The map's own reference is only dropped after this epoch ends */ \
+                guard = node->guard;                        \
+                raise_guard_##NAME(guard);                  \
+                break;                                      \
+            }                                               \
+        }                                                   \
+        heap_guard_epoch_exit();                            \
+                                                            \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline int guard_map_##NAME##_insert(            \
+        guard_map_##NAME##_t *map,                          \
+        const uint64_t key,                                 \
+        heap_guard_##NAME##_t *guard                        \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        mutex_t *stripe = &map->stripes[(hash >> 32) & (HEAP_GUARD_MAP_STRIPES - 1)]; \
+                                                            \
+        guard_map_##NAME##_node_t *node = (guard_map_##NAME##_node_t *)malloc(sizeof(guard_map_##NAME##_node_t)); \
+        if (node == NULL)                                   \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        __fluent_libc_hp_##NAME##_promote(guard);           \
+        node->key = key;                                    \
+        node->guard = guard;                                \
+        node->insertion_concurrent = map->insertion_concurrent; \
+                                                            \
+        mutex_lock(stripe);                                 \
+        /* Probes read nodes of other stripes' keys, which their writers may retire */ \
+        heap_guard_epoch_enter();                           \
+        /* Rebuilds hold every stripe, so the table is stable while this one is held */ \
+        guard_map_##NAME##_table_t *table = atomic_load_explicit(&map->table, memory_order_acquire); \
+        for (;;)                                            \
+        {                                                   \
+            /* The whole chain is checked for the key before a free slot is taken */ \
+            size_t target = SIZE_MAX;                       \
+            guard_map_##NAME##_node_t *expected = NULL;     \
+            int present = 0;                                \
+                                                            \
+            for (size_t step = 0, i = hash & table->mask; step <= table->mask; step++, i = (i + 1) & table->mask) \
+            {                                               \
+                guard_map_##NAME##_node_t *current = atomic_load_explicit(&table->slots[i], memory_order_acquire); \
+                if (current == NULL || current == &map->tombstone) \
+                {                                           \
+                    if (target == SIZE_MAX)                 \
+                    {                                       \
+                        target = i;                         \
+                        expected = current;                 \
+                    }                                       \
+                                                            \
+                    if (current == NULL)                    \
+                    {                                       \
+                        break;                              \
+                    }                                       \
+                    continue;                               \
+                }                                           \
+                                                            \
+                if (current->key == key)                    \
+                {                                           \
+                    present = 1;                            \
+                    break;                                  \
+                }                                           \
+            }                                               \
+                                                            \
+            if (present || target == SIZE_MAX)              \
+            {                                               \
+                heap_guard_epoch_exit();                    \
+                mutex_unlock(stripe);                       \
+                free(node);                                 \
+                return -1;                                  \
+            }                                               \
+                                                            \
+            /* Writers of other keys may race for the same slot */ \
+            if (atomic_compare_exchange_strong_explicit(&table->slots[target], &expected, node, memory_order_release, memory_order_relaxed)) \
+            {                                               \
+                if (expected == &map->tombstone)            \
+                {                                           \
+                    atomic_size_fetch_sub(&map->tombstones, 1); \
+                }                                           \
+                                                            \
+                /* The caller still holds its own reference, so raising late is safe */ \
+                raise_guard_##NAME(guard);                  \
+                break;                                      \
+            }                                               \
+        }                                                   \
+        heap_guard_epoch_exit();                            \
+        mutex_unlock(stripe);                               \
+                                                            \
+        atomic_size_fetch_add(&map->count, 1);              \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline int guard_map_##NAME##_remove(            \
+        guard_map_##NAME##_t *map,                          \
+        const uint64_t key                                  \
+    )                                                       \
+    {                                                       \
+        const uint64_t hash = __fluent_libc_hg_mix64(key);  \
+        mutex_t *stripe = &map->stripes[(hash >> 32) & (HEAP_GUARD_MAP_STRIPES - 1)]; \
+        guard_map_##NAME##_node_t *node = NULL;             \
+                                                            \
+        mutex_lock(stripe);                                 \
+        heap_guard_epoch_enter();                           \
+        guard_map_##NAME##_table_t *table = atomic_load_explicit(&map->table, memory_order_acquire); \
+        const size_t slots = table->mask + 1; /* the table may be retired once unlocked */ \
+        size_t tombstones = 0;                              \
+        for (size_t step = 0, i = hash & table->mask; step <= table->mask; step++, i = (i + 1) & table->mask) \
+        {                                                   \
+            guard_map_##NAME##_node_t *current = atomic_load_explicit(&table->slots[i], memory_order_acquire); \
+            if (current == NULL)                            \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (current != &map->tombstone && current->key == key) \
+            {                                               \
+                /* Only this stripe's writers touch this key's node, a store suffices */ \
+                atomic_store_explicit(&table->slots[i], &map->tombstone, memory_order_release); \
+                tombstones = atomic_size_fetch_add(&map->tombstones, 1) + 1; \
+                node = current;                             \
+                break;                                      \
+            }                                               \
+        }                                                   \
+        heap_guard_epoch_exit();                            \
+        mutex_unlock(stripe);                               \
+                                                            \
+        if (node == NULL)                                   \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        atomic_size_fetch_sub(&map->count, 1);              \
+        heap_guard_epoch_retire(&node->retired, __fluent_libc_gm_##NAME##_reclaim); \
+                                                            \
+        if (tombstones >= slots / 4)                        \
+        {                                                   \
+            __fluent_libc_gm_##NAME##_rehash(map);          \
+        }                                                   \
+                                                            \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline size_t guard_map_##NAME##_count(guard_map_##NAME##_t *map) \
+    {                                                       \
+        return atomic_size_load(&map->count);               \
+    }                                                       \
+                                                            \
+    static inline void guard_map_##NAME##_destroy(guard_map_##NAME##_t *map) \
+    {                                                       \
+        /* No other thread may use the map anymore, flush what removals retired */ \
+        heap_guard_epoch_synchronize();                     \
+                                                            \
+        guard_map_##NAME##_table_t *table = atomic_load_explicit(&map->table, memory_order_relaxed); \
+        for (size_t i = 0; i <= table->mask; i++)           \
+        {                                                   \
+            guard_map_##NAME##_node_t *node = atomic_load_explicit(&table->slots[i], memory_order_relaxed); \
+            if (node != NULL && node != &map->tombstone)    \
+            {                                               \
+                __fluent_libc_gm_##NAME##_reclaim(&node->retired); \
+            }                                               \
+        }                                                   \
+                                                            \
+        for (size_t i = 0; i < HEAP_GUARD_MAP_STRIPES; i++) \
+        {                                                   \
+            mutex_destroy(&map->stripes[i]);                \
+        }                                                   \
+                                                            \
+        free(table);                                        \
+        atomic_store_explicit(&map->table, NULL, memory_order_relaxed); \
+    }
+
+
+#endif // _WIN32
+
+// ============= GUARD QUEUE =============
+// Bounded lock-free MPMC queue of guards (Vyukov's sequenced
+// ring). A guard moves through it together with one reference:
+// push gives the caller's reference to the queue and pop hands
+// it to the consumer, so a hop costs no refcount traffic.
+// Batches claim a run of consecutive cells with a single CAS.
+#ifndef _WIN32
+
+#define DEFINE_HEAP_GUARD_QUEUE(V, NAME) \
+    typedef struct guard_queue_##NAME##_cell_t              \
+    {                                                       \
+        _Atomic size_t sequence;                            \
+        heap_guard_##NAME##_t *guard;                       \
+    } guard_queue_##NAME##_cell_t;                          \
+                                                            \
+    typedef struct guard_queue_##NAME##_t                   \
+    {                                                       \
+        _Alignas(HEAP_GUARD_CACHE_LINE) _Atomic size_t enqueue_pos; \
+        _Alignas(HEAP_GUARD_CACHE_LINE) _Atomic size_t dequeue_pos; \
+        _Alignas(HEAP_GUARD_CACHE_LINE) guard_queue_##NAME##_cell_t *cells; \
+        size_t mask;                                        \
+        int insertion_concurrent;                           \
+    } guard_queue_##NAME##_t;                               \
+                                                            \
+    static inline int guard_queue_##NAME##_init(            \
+        guard_queue_##NAME##_t *queue,                      \
+        const size_t capacity,                              \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        size_t cells = 2;                                   \
+        while (cells < capacity)                            \
+        {                                                   \
+            cells <<= 1;                                    \
+        }                                                   \
+                                                            \
+        queue->cells = (guard_queue_##NAME##_cell_t *)malloc(cells * sizeof(guard_queue_##NAME##_cell_t)); \
+        if (queue->cells == NULL)                           \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        for (size_t i = 0; i < cells; i++)                  \
+        {                                                   \
+            atomic_init(&queue->cells[i].sequence, i);      \
+            queue->cells[i].guard = NULL;                   \
+        }                                                   \
+                                                            \
+        queue->mask = cells - 1;                            \
+        queue->insertion_concurrent = insertion_concurrent; \
+        atomic_init(&queue->enqueue_pos, 0);                \
+        atomic_init(&queue->dequeue_pos, 0);                \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    /* Claims up to `max` consecutive cells from `pos_ptr`, a cell is free for ticket t when its sequence reads t + lag */ \
+    static inline size_t __fluent_libc_gq_##NAME##_claim(   \
+        guard_queue_##NAME##_t *queue,                      \
+        _Atomic size_t *pos_ptr,                            \
+        const size_t lag,                                   \
+        const size_t max,                                   \
+        size_t *first                                       \
+    )                                                       \
+    {                                                       \
+        size_t pos = atomic_load_explicit(pos_ptr, memory_order_relaxed); \
+        for (;;)                                            \
+        {                                                   \
+            size_t count = 0;                               \
+            while (count < max)                             \
+            {                                               \
+                const size_t ticket = pos + count;          \
+                const size_t sequence = atomic_load_explicit(&queue->cells[ticket & queue->mask].sequence, memory_order_acquire); \
+                if (sequence != ticket + lag)               \
+                {                                           \
+                    break;                                  \
+                }                                           \
+                count++;                                    \
+            }                                               \
+                                                            \
+            if (count == 0)                                 \
+            {                                               \
+                /* Either full/empty, or another thread moved past `pos` */ \
+                const size_t current = atomic_load_explicit(pos_ptr, memory_order_relaxed); \
+                if (current == pos)                         \
+                {                                           \
+                    return 0;                               \
+                }                                           \
+                                                            \
+                pos = current;                              \
+                continue;                                   \
+            }                                               \
+                                                            \
+            if (atomic_compare_exchange_weak_explicit(pos_ptr, &pos, pos + count, memory_order_relaxed, memory_order_relaxed)) \
+            {                                               \
+                *first = pos;                               \
+                return count;                               \
+            }                                               \
+        }                                                   \
+    }                                                       \
+                                                            \
+    /* Hands `count` guards to the queue, the caller's references move with them; returns how many fit */ \
+    static inline size_t guard_queue_##NAME##_push_batch(   \
+        guard_queue_##NAME##_t *queue,                      \
+        heap_guard_##NAME##_t **guards,                     \
+        const size_t count                                  \
+    )                                                       \
+    {                                                       \
+        size_t first = 0;                                   \
+        const size_t claimed = __fluent_libc_gq_##NAME##_claim(queue, &queue->enqueue_pos, 0, count, &first); \
+                                                            \
+        for (size_t i = 0; i < claimed; i++)                \
+        {                                                   \
+            guard_queue_##NAME##_cell_t *cell = &queue->cells[(first + i) & queue->mask]; \
+            /* A sole reference only changes threads, shared ones need atomics */ \
+            if (!guards[i]->concurrent && guards[i]->ref_count > 1) \
+            {                                               \
+                __fluent_libc_hp_##NAME##_promote(guards[i]); \
+            }                                               \
+                                                            \
+            cell->guard = guards[i];                        \
+            atomic_store_explicit(&cell->sequence, first + i + 1, memory_order_release); \
+        }                                                   \
+                                                            \
+        return claimed;                                     \
+    }                                                       \
+                                                            \
+    /* Takes up to `max` guards, each arrives with the reference its producer gave up */ \
+    static inline size_t guard_queue_##NAME##_pop_batch(    \
+        guard_queue_##NAME##_t *queue,                      \
+        heap_guard_##NAME##_t **out,                        \
+        const size_t max                                    \
+    )                                                       \
+    {                                                       \
+        size_t first = 0;                                   \
+        const size_t claimed = __fluent_libc_gq_##NAME##_claim(queue, &queue->dequeue_pos, 1, max, &first); \
+                                                            \
+        for (size_t i = 0; i < claimed; i++)                \
+        {                                                   \
+            guard_queue_##NAME##_cell_t *cell = &queue->cells[(first + i) & queue->mask]; \
+            out[i] = cell->guard;                           \
+            atomic_store_explicit(&cell->sequence, first + i + queue->mask + 1, memory_order_release); \
+        }                                                   \
+                                                            \
+        return claimed;                                     \
+    }                                                       \
+                                                            \
+    static inline int guard_queue_##NAME##_push(            \
+        guard_queue_##NAME##_t *queue,                      \
+        heap_guard_##NAME##_t *guard                        \
+    )                                                       \
+    {                                                       \
+        return guard_queue_##NAME##_push_batch(queue, &guard, 1) == 1 ? 0 : -1; \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *guard_queue_##NAME##_pop(guard_queue_##NAME##_t *queue) \
+    {                                                       \
+        heap_guard_##NAME##_t *guard = NULL;                \
+        guard_queue_##NAME##_pop_batch(queue, &guard, 1);   \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline void guard_queue_##NAME##_destroy(guard_queue_##NAME##_t *queue) \
+    {                                                       \
+        /* Guards still queued belong to the queue, lower them */ \
+        heap_guard_##NAME##_t *guard = NULL;                \
+        while ((guard = guard_queue_##NAME##_pop(queue)) != NULL) \
+        {                                                   \
+            lower_guard_##NAME(&guard, queue->insertion_concurrent); \
+        }                                                   \
+                                                            \
+        free(queue->cells);                                 \
+        queue->cells = NULL;                                \
+    }
+
+
+#endif // _WIN32
+
+// ============= I/O BUFFERS =============
+// Page-aligned, fixed-size byte buffers for scatter/gather I/O.
+// Buffers are ordinary guards of a generated byte-array type, so
+// raise/lower/drop, limits and slices all apply. Slab blocks are
+// whole pages: the first one holds the block header, the rest
+// are buffers, which keeps a block's data region contiguous and
+// registrable with io_uring in one iovec.
+#define HEAP_GUARD_BUFFER_PAGE 4096
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       include <linux/io_uring.h>
+#       define __FLUENT_LIBC_HG_HAVE_IO_URING 1
+#   endif
+#endif
+
+#ifndef _WIN32
+
+/**
+ * Orders block addresses for the fixed-buffer table.
+ */
+static inline int __fluent_libc_hg_addr_cmp(const void *a, const void *b)
+{
+    const uintptr_t x = (uintptr_t)*(void *const *)a;
+    const uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+#define __FLUENT_LIBC_HG_IOVEC_API(NAME) \
+    static inline int heap_##NAME##_reserve_buffers(const size_t count, const int insertion_concurrent) \
+    {                                                       \
+        if (__fluent_libc_hp_##NAME##_init() != 0)          \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = insertion_concurrent ? __fluent_libc_impl_hg_##NAME##_mutex : NULL; \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_lock(mutex);                              \
+        }                                                   \
+                                                            \
+        const int result = __fluent_libc_hg_slab_reserve(&__fluent_libc_hg_##NAME##_val_slab, count); \
+                                                            \
+        if (mutex != NULL)                                  \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+        }                                                   \
+                                                            \
+        return result;                                      \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_iovec(               \
+        heap_guard_##NAME##_t *const *guards,               \
+        const size_t *lengths,                              \
+        const size_t count,                                 \
+        struct iovec *out                                   \
+    )                                                       \
+    {                                                       \
+        /* NULL lengths export each payload whole */        \
+        for (size_t i = 0; i < count; i++)                  \
+        {                                                   \
+            const size_t whole = guards[i]->allocated * sizeof(*guards[i]->ptr); \
+            out[i].iov_base = guards[i]->ptr;               \
+            out[i].iov_len = lengths != NULL && lengths[i] < whole ? lengths[i] : whole; \
+        }                                                   \
+                                                            \
+        return count;                                       \
+    }
+
+#ifdef __FLUENT_LIBC_HG_HAVE_IO_URING
+
+#define __FLUENT_LIBC_HG_IO_URING_API(NAME) \
+    void **__fluent_libc_hg_##NAME##_fixed_blocks = NULL;   \
+    size_t __fluent_libc_hg_##NAME##_fixed_count = 0;       \
+                                                            \
+    static inline int heap_##NAME##_register_io_uring(const int ring_fd) \
+    {                                                       \
+        if (__fluent_libc_hp_##NAME##_init() != 0 || __fluent_libc_hg_##NAME##_fixed_blocks != NULL) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = __fluent_libc_impl_hg_##NAME##_mutex; \
+        mutex_lock(mutex);                                  \
+                                                            \
+        __fluent_libc_hg_slab_t *slab = &__fluent_libc_hg_##NAME##_val_slab; \
+        const size_t n = slab->block_count;                 \
+        void **blocks = n ? (void **)malloc(n * sizeof(void *)) : NULL; \
+        struct iovec *iov = n ? (struct iovec *)malloc(n * sizeof(struct iovec)) : NULL; \
+        if (n == 0 || blocks == NULL || iov == NULL)        \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+            free(blocks);                                   \
+            free(iov);                                      \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        size_t i = 0;                                       \
+        for (__fluent_libc_hg_block_t *block = slab->blocks; block != NULL; block = block->next) \
+        {                                                   \
+            blocks[i++] = block;                            \
+        }                                                   \
+                                                            \
+        /* Table order is the kernel's buf_index order */   \
+        qsort(blocks, n, sizeof(void *), __fluent_libc_hg_addr_cmp); \
+        for (i = 0; i < n; i++)                             \
+        {                                                   \
+            iov[i].iov_base = (char *)blocks[i] + slab->data_offset; \
+            iov[i].iov_len = slab->slots_per_block * slab->slot_size; \
+        }                                                   \
+                                                            \
+        const long rc = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, (unsigned)n); \
+        free(iov);                                          \
+        if (rc < 0)                                         \
+        {                                                   \
+            mutex_unlock(mutex);                            \
+            free(blocks);                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        /* The kernel holds the pages pinned, trimming must not unmap them */ \
+        slab->pinned = 1;                                   \
+        __fluent_libc_hg_##NAME##_fixed_blocks = blocks;    \
+        __fluent_libc_hg_##NAME##_fixed_count = n;          \
+        mutex_unlock(mutex);                                \
+        return 0;                                           \
+    }                                                       \
+                                                            \
+    static inline int heap_##NAME##_fixed_index(const heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        if (guard->__origin != HEAP_GUARD_ORIGIN_POOL || __fluent_libc_hg_##NAME##_fixed_blocks == NULL) \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        const uintptr_t block = (uintptr_t)guard->ptr & ~(uintptr_t)(__fluent_libc_hg_##NAME##_val_slab.block_size - 1); \
+        size_t low = 0;                                     \
+        size_t high = __fluent_libc_hg_##NAME##_fixed_count; \
+        while (low < high)                                  \
+        {                                                   \
+            const size_t mid = low + (high - low) / 2;      \
+            const uintptr_t at = (uintptr_t)__fluent_libc_hg_##NAME##_fixed_blocks[mid]; \
+            if (at == block)                                \
+            {                                               \
+                return (int)mid;                            \
+            }                                               \
+                                                            \
+            if (at < block)                                 \
+            {                                               \
+                low = mid + 1;                              \
+            }                                               \
+            else                                            \
+            {                                               \
+                high = mid;                                 \
+            }                                               \
+        }                                                   \
+                                                            \
+        /* Grown after registration */                      \
+        return -1;                                          \
+    }                                                       \
+                                                            \
+    static inline int heap_##NAME##_unregister_io_uring(const int ring_fd) \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_fixed_blocks == NULL) \
+        {                                                   \
+            return -1;                                      \
         }                                                   \
                                                             \
-        if (!is_exit)                                       \
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0) \
         {                                                   \
-            if (guard->ptr != NULL)                         \
+            return -1;                                      \
+        }                                                   \
+                                                            \
+        mutex_t *mutex = __fluent_libc_impl_hg_##NAME##_mutex; \
+        mutex_lock(mutex);                                  \
+        __fluent_libc_hg_##NAME##_val_slab.pinned = 0;      \
+        free(__fluent_libc_hg_##NAME##_fixed_blocks);       \
+        __fluent_libc_hg_##NAME##_fixed_blocks = NULL;      \
+        __fluent_libc_hg_##NAME##_fixed_count = 0;          \
+        mutex_unlock(mutex);                                \
+        return 0;                                           \
+    }
+
+#else
+
+#define __FLUENT_LIBC_HG_IO_URING_API(NAME)
+
+#endif // __FLUENT_LIBC_HG_HAVE_IO_URING
+
+#else
+
+#define __FLUENT_LIBC_HG_IOVEC_API(NAME)
+#define __FLUENT_LIBC_HG_IO_URING_API(NAME)
+
+#endif // _WIN32
+
+#define DEFINE_HEAP_GUARD_BUFFERS(NAME, BUFFER_SIZE, ARENA_SIZE) \
+    _Static_assert((BUFFER_SIZE) % HEAP_GUARD_BUFFER_PAGE == 0, \
+        "heap_guard: BUFFER_SIZE must be a multiple of the page size"); \
+                                                            \
+    typedef struct heap_##NAME##_bytes_t                    \
+    {                                                       \
+        unsigned char bytes[BUFFER_SIZE];                   \
+    } heap_##NAME##_bytes_t;                                \
+                                                            \
+    DEFINE_HEAP_GUARD_ALIGNED(heap_##NAME##_bytes_t, NAME, ARENA_SIZE, HEAP_GUARD_BUFFER_PAGE) \
+    __FLUENT_LIBC_HG_IOVEC_API(NAME)                        \
+    __FLUENT_LIBC_HG_IO_URING_API(NAME)
+
+// ============= COMPACT GUARDS =============
+// Sixteen-byte guards for small payloads: the payload pointer,
+// one 32-bit word holding the count and the mode flags, and the
+// embedded lock. Destructors, arrays, exit tracking, limits and
+// the optional lock modes are left out; the pool lock is a lock
+// word as well, so a compact type allocates nothing but its
+// slab blocks. Payloads up to HEAP_GUARD_INLINE_MAX bytes live
+// right behind the header, so a compact guard of a long takes 24
+// bytes and more than two share a 64-byte cache line; a full
+// header fills the line on its own and has a tracker on top
+// (bench/compact_rss measures both).
+#define HEAP_GUARD_COMPACT_CONCURRENT 0x80000000u // atomic count
+#define HEAP_GUARD_COMPACT_EXTERNAL 0x40000000u   // payload not from the slab
+#define HEAP_GUARD_COMPACT_COUNT 0x3FFFFFFFu
+#define HEAP_GUARD_COMPACT_IMMORTAL 0x20000000u
+#define HEAP_GUARD_COMPACT_IMMORTAL_FLOOR 0x10000000u
+
+#ifndef _WIN32
+#   define __fluent_libc_hg_atfork(prepare, parent, child) pthread_atfork(prepare, parent, child)
+#else
+#   define __fluent_libc_hg_atfork(prepare, parent, child) ((void)0)
+#endif
+
+#define DEFINE_HEAP_GUARD_COMPACT(V, NAME, ARENA_SIZE) \
+    typedef struct heap_guard_##NAME##_t                    \
+    {                                                       \
+        V *ptr;                                             \
+        __fluent_libc_hg_lock_t __state; /* flags | count */ \
+        __fluent_libc_hg_lock_t __lock; /* lock_guard/unlock_guard */ \
+    } heap_guard_##NAME##_t;                                \
+                                                            \
+    _Static_assert(sizeof(heap_guard_##NAME##_t) <= 16, "heap_guard: compact header grew past 16 bytes"); \
+                                                            \
+    __fluent_libc_hg_lock_t __fluent_libc_hg_##NAME##_pool_lock; \
+    int __fluent_libc_hg_##NAME##_slabs_ready = 0;          \
+    int __fluent_libc_hg_##NAME##_trim_registered = 0; /* under the pool lock */ \
+    int __fluent_libc_hg_##NAME##_has_put_atexit_guard = 0; \
+    __fluent_libc_hg_slab_t __fluent_libc_hg_##NAME##_val_slab; \
+    __fluent_libc_hg_slab_t __fluent_libc_hg_##NAME##_guard_slab; \
+                                                            \
+    static inline size_t heap_##NAME##_footprint()          \
+    {                                                       \
+        return __fluent_libc_hg_##NAME##_val_slab.block_count * __fluent_libc_hg_##NAME##_val_slab.block_size + \
+            __fluent_libc_hg_##NAME##_guard_slab.block_count * __fluent_libc_hg_##NAME##_guard_slab.block_size; \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_trim()               \
+    {                                                       \
+        __fluent_libc_hg_lock_acquire(&__fluent_libc_hg_##NAME##_pool_lock); \
+        size_t released = 0;                                \
+        if (__fluent_libc_hg_##NAME##_slabs_ready)          \
+        {                                                   \
+            released = __fluent_libc_hg_slab_trim(&__fluent_libc_hg_##NAME##_val_slab) + \
+                __fluent_libc_hg_slab_trim(&__fluent_libc_hg_##NAME##_guard_slab); \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_lock_release(&__fluent_libc_hg_##NAME##_pool_lock); \
+        return released;                                    \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_destroy()  \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_slabs_ready)          \
+        {                                                   \
+            __fluent_libc_hg_pressure_unregister(heap_##NAME##_trim); \
+            __fluent_libc_hg_##NAME##_trim_registered = 0;  \
+            __fluent_libc_hg_slab_destroy(&__fluent_libc_hg_##NAME##_val_slab); \
+            __fluent_libc_hg_slab_destroy(&__fluent_libc_hg_##NAME##_guard_slab); \
+            __fluent_libc_hg_##NAME##_slabs_ready = 0;      \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline int __fluent_libc_hp_##NAME##_inline()    \
+    {                                                       \
+        return sizeof(V) <= HEAP_GUARD_INLINE_MAX && _Alignof(V) <= _Alignof(max_align_t); \
+    }                                                       \
+                                                            \
+    static inline size_t __fluent_libc_hp_##NAME##_inline_offset() \
+    {                                                       \
+        return __fluent_libc_hg_align_up(sizeof(heap_guard_##NAME##_t), _Alignof(V)); \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_fork_prepare() \
+    {                                                       \
+        __fluent_libc_hg_lock_acquire(&__fluent_libc_hg_##NAME##_pool_lock); \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_fork_parent() \
+    {                                                       \
+        __fluent_libc_hg_lock_release(&__fluent_libc_hg_##NAME##_pool_lock); \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_fork_child() \
+    {                                                       \
+        __fluent_libc_hg_lock_init(&__fluent_libc_hg_##NAME##_pool_lock); \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_init()     \
+    {                                                       \
+        /* Under the pool lock */                           \
+        if (!__fluent_libc_hg_##NAME##_has_put_atexit_guard) \
+        {                                                   \
+            atexit(__fluent_libc_hp_##NAME##_destroy);      \
+            __fluent_libc_hg_pressure_install();            \
+            __fluent_libc_hg_atfork(                        \
+                __fluent_libc_hp_##NAME##_fork_prepare,     \
+                __fluent_libc_hp_##NAME##_fork_parent,      \
+                __fluent_libc_hp_##NAME##_fork_child        \
+            );                                              \
+            __fluent_libc_hg_##NAME##_has_put_atexit_guard = 1; \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_slab_init(&__fluent_libc_hg_##NAME##_val_slab, sizeof(V), _Alignof(V), ARENA_SIZE); \
+        __fluent_libc_hg_slab_init(                         \
+            &__fluent_libc_hg_##NAME##_guard_slab,          \
+            __fluent_libc_hp_##NAME##_inline() ? __fluent_libc_hp_##NAME##_inline_offset() + sizeof(V) : sizeof(heap_guard_##NAME##_t), \
+            __fluent_libc_hp_##NAME##_inline() && _Alignof(V) > _Alignof(heap_guard_##NAME##_t) \
+                ? _Alignof(V) : _Alignof(heap_guard_##NAME##_t), \
+            ARENA_SIZE                                      \
+        );                                                  \
+        __fluent_libc_hg_##NAME##_slabs_ready = 1;          \
+    }                                                       \
+                                                            \
+    static inline heap_guard_##NAME##_t *heap_##NAME##_alloc( \
+        const int is_concurrent,                            \
+        const int insertion_concurrent,                     \
+        V *default_ptr                                      \
+    )                                                       \
+    {                                                       \
+        if (insertion_concurrent)                           \
+        {                                                   \
+            __fluent_libc_hg_lock_acquire(&__fluent_libc_hg_##NAME##_pool_lock); \
+        }                                                   \
+                                                            \
+        if (!__fluent_libc_hg_##NAME##_slabs_ready)         \
+        {                                                   \
+            __fluent_libc_hp_##NAME##_init();               \
+        }                                                   \
+                                                            \
+        /* Only pools that take the lock can be trimmed by the monitor */ \
+        /* A full registry leaves the pool to heap_NAME_trim() */ \
+        if (insertion_concurrent && !__fluent_libc_hg_##NAME##_trim_registered) \
+        {                                                   \
+            (void)__fluent_libc_hg_pressure_register(heap_##NAME##_trim); \
+            __fluent_libc_hg_##NAME##_trim_registered = 1;  \
+        }                                                   \
+                                                            \
+        heap_guard_##NAME##_t *guard = (heap_guard_##NAME##_t *)__fluent_libc_hg_slab_malloc(&__fluent_libc_hg_##NAME##_guard_slab); \
+        V *ptr = default_ptr;                               \
+        if (guard != NULL && ptr == NULL && __fluent_libc_hp_##NAME##_inline()) \
+        {                                                   \
+            ptr = (V *)((char *)guard + __fluent_libc_hp_##NAME##_inline_offset()); \
+        }                                                   \
+        else if (guard != NULL && ptr == NULL)              \
+        {                                                   \
+            ptr = (V *)__fluent_libc_hg_slab_malloc(&__fluent_libc_hg_##NAME##_val_slab); \
+            if (ptr == NULL)                                \
+            {                                               \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_guard_slab, guard); \
+                guard = NULL;                               \
+            }                                               \
+        }                                                   \
+                                                            \
+        if (insertion_concurrent)                           \
+        {                                                   \
+            __fluent_libc_hg_lock_release(&__fluent_libc_hg_##NAME##_pool_lock); \
+        }                                                   \
+                                                            \
+        if (guard == NULL)                                  \
+        {                                                   \
+            return NULL;                                    \
+        }                                                   \
+                                                            \
+        guard->ptr = ptr;                                   \
+        __fluent_libc_hg_lock_init(&guard->__state);        \
+        __fluent_libc_hg_word_set(&guard->__state,          \
+            1 | (is_concurrent ? HEAP_GUARD_COMPACT_CONCURRENT : 0) | (default_ptr != NULL ? HEAP_GUARD_COMPACT_EXTERNAL : 0)); \
+        __fluent_libc_hg_lock_init(&guard->__lock);         \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline void raise_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        const uint32_t state = __fluent_libc_hg_lock_peek(&guard->__state); \
+        if ((state & HEAP_GUARD_COMPACT_COUNT) >= HEAP_GUARD_COMPACT_IMMORTAL_FLOOR) \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        if (state & HEAP_GUARD_COMPACT_CONCURRENT)          \
+        {                                                   \
+            __fluent_libc_hg_word_fetch_add(&guard->__state, 1); \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            __fluent_libc_hg_word_set(&guard->__state, state + 1); \
+        }                                                   \
+    }                                                       \
+                                                            \
+    static inline void lower_guard_##NAME(                  \
+        heap_guard_##NAME##_t **guard_ptr,                  \
+        const int insertion_concurrent                      \
+    )                                                       \
+    {                                                       \
+        if (guard_ptr == NULL || *guard_ptr == NULL)        \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        heap_guard_##NAME##_t *guard = *guard_ptr;          \
+        uint32_t state = __fluent_libc_hg_lock_peek(&guard->__state); \
+        if ((state & HEAP_GUARD_COMPACT_COUNT) >= HEAP_GUARD_COMPACT_IMMORTAL_FLOOR) \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        if (state & HEAP_GUARD_COMPACT_CONCURRENT)          \
+        {                                                   \
+            /* Only the thread that takes the count to zero may free */ \
+            state = __fluent_libc_hg_word_fetch_add(&guard->__state, (uint32_t)-1); \
+        }                                                   \
+        else                                                \
+        {                                                   \
+            __fluent_libc_hg_word_set(&guard->__state, state - 1); \
+        }                                                   \
+                                                            \
+        if ((state & HEAP_GUARD_COMPACT_COUNT) != 1)        \
+        {                                                   \
+            return;                                         \
+        }                                                   \
+                                                            \
+        if (insertion_concurrent)                           \
+        {                                                   \
+            __fluent_libc_hg_lock_acquire(&__fluent_libc_hg_##NAME##_pool_lock); \
+        }                                                   \
+                                                            \
+        if (__fluent_libc_hg_##NAME##_slabs_ready)          \
+        {                                                   \
+            if (!(state & HEAP_GUARD_COMPACT_EXTERNAL) && !__fluent_libc_hp_##NAME##_inline()) \
             {                                               \
-                vec___fluent_libc_hp_fl_##NAME##_push(__fluent_libc_hg_##NAME##_free_list, guard->ptr); \
+                __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_val_slab, guard->ptr); \
             }                                               \
                                                             \
-            vec___fluent_libc_hph_fl_##NAME##_push(__fluent_libc_hgh_##NAME##_free_list, guard); \
+            __fluent_libc_hg_slab_free(&__fluent_libc_hg_##NAME##_guard_slab, guard); \
+        }                                                   \
+                                                            \
+        if (insertion_concurrent)                           \
+        {                                                   \
+            __fluent_libc_hg_lock_release(&__fluent_libc_hg_##NAME##_pool_lock); \
         }                                                   \
                                                             \
         *guard_ptr = NULL;                                  \
     }                                                       \
                                                             \
-    static inline void __fluent_libc_hp_##NAME##_destroy()  \
+    static inline heap_guard_##NAME##_t *share_guard_##NAME(heap_guard_##NAME##_t *guard) \
     {                                                       \
-        __fluent_libc_heap_##NAME##_tracker_t *current = __fluent_libc_impl_heap_##NAME##_guards; \
+        /* Owning thread only, before the guard reaches another one */ \
+        const uint32_t state = __fluent_libc_hg_lock_peek(&guard->__state); \
+        if (!(state & HEAP_GUARD_COMPACT_CONCURRENT))       \
+        {                                                   \
+            __fluent_libc_hg_word_set(&guard->__state, state | HEAP_GUARD_COMPACT_CONCURRENT); \
+        }                                                   \
                                                             \
-        while (current != NULL)                             \
+        raise_guard_##NAME(guard);                          \
+        return guard;                                       \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_make_immortal(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        /* Flags are fixed once the guard is shared, only the count moves */ \
+        const uint32_t flags = __fluent_libc_hg_lock_peek(&guard->__state) & ~HEAP_GUARD_COMPACT_COUNT; \
+        __fluent_libc_hg_word_store(&guard->__state, flags | HEAP_GUARD_COMPACT_IMMORTAL); \
+    }                                                       \
+                                                            \
+    static inline size_t heap_##NAME##_ref_count(const heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        return __fluent_libc_hg_lock_peek((__fluent_libc_hg_lock_t *)&guard->__state) & HEAP_GUARD_COMPACT_COUNT; \
+    }                                                       \
+                                                            \
+    static inline void lock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_lock_acquire(&guard->__lock);      \
+    }                                                       \
+                                                            \
+    static inline int trylock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        return __fluent_libc_hg_lock_try(&guard->__lock);   \
+    }                                                       \
+                                                            \
+    static inline void unlock_guard_##NAME(heap_guard_##NAME##_t *guard) \
+    {                                                       \
+        __fluent_libc_hg_lock_release(&guard->__lock);      \
+    }
+
+
+// ============= FORK HANDLING =============
+// pthread_atfork() hooks installed with the first allocation
+// of a type. The registry mutex is held across fork() so the
+// child never inherits it mid-update, and re-initialized in
+// the child since the forking thread is the only survivor.
+#ifndef _WIN32
+
+#define HEAP_GUARD_FORK_KEEP 0  // child keeps every inherited guard
+#define HEAP_GUARD_FORK_RESET 1 // child starts from empty pools
+
+#define __FLUENT_LIBC_HG_FORK_API(V, NAME) \
+    int __fluent_libc_hg_##NAME##_fork_policy = HEAP_GUARD_FORK_KEEP; \
+    int __fluent_libc_hg_##NAME##_has_put_atfork_guard = 0; \
+    mutex_t *__fluent_libc_hg_##NAME##_fork_locked = NULL;  \
+                                                            \
+    static inline void heap_##NAME##_set_fork_policy(const int policy) \
+    {                                                       \
+        __fluent_libc_hg_##NAME##_fork_policy = policy;     \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_fork_reset()           \
+    {                                                       \
+        /* Inherited guards are forgotten, not destructed */ \
+        __fluent_libc_impl_heap_##NAME##_guards = NULL;     \
+        __fluent_libc_hp_##NAME##_destroy();                \
+    }                                                       \
+                                                            \
+    static inline void __fluent_libc_hp_##NAME##_atfork_prepare() \
+    {                                                       \
+        __fluent_libc_hg_##NAME##_fork_locked = __fluent_libc_impl_hg_##NAME##_mutex; \
+        if (__fluent_libc_hg_##NAME##_fork_locked != NULL)  \
         {                                                   \
-            heap_guard_##NAME##_t *guard = current->guard;  \
+            mutex_lock(__fluent_libc_hg_##NAME##_fork_locked); \
+        }                                                   \
+    }                                                       \
                                                             \
-           if (guard != NULL)                               \
-           {                                                \
-               drop_guard_##NAME(&guard, 1);                \
-           }                                                \
+    static inline void __fluent_libc_hp_##NAME##_atfork_parent() \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_fork_locked != NULL)  \
+        {                                                   \
+            mutex_unlock(__fluent_libc_hg_##NAME##_fork_locked); \
+            __fluent_libc_hg_##NAME##_fork_locked = NULL;   \
+        }                                                   \
+    }                                                       \
                                                             \
-           current = current->next;                         \
+    static inline void __fluent_libc_hp_##NAME##_atfork_child() \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_fork_locked != NULL)  \
+        {                                                   \
+            mutex_init(__fluent_libc_hg_##NAME##_fork_locked); \
+            __fluent_libc_hg_##NAME##_fork_locked = NULL;   \
         }                                                   \
                                                             \
-        if (__fluent_libc_hg_##NAME##_arena_allocator)      \
+        __fluent_libc_hp_##NAME##_wait_reset();             \
+                                                            \
+        if (__fluent_libc_hg_##NAME##_fork_policy == HEAP_GUARD_FORK_RESET) \
         {                                                   \
-            destroy_arena(__fluent_libc_hg_##NAME##_arena_allocator); \
+            heap_##NAME##_fork_reset();                     \
         }                                                   \
+    }                                                       \
                                                             \
-        if (__fluent_libc_hg_heap_##NAME##_arena_allocator) \
+    static inline void __fluent_libc_hp_##NAME##_register_atfork() \
+    {                                                       \
+        if (!__fluent_libc_hg_##NAME##_has_put_atfork_guard) \
         {                                                   \
-            destroy_arena(__fluent_libc_hg_heap_##NAME##_arena_allocator); \
+            pthread_atfork(                                 \
+                __fluent_libc_hp_##NAME##_atfork_prepare,   \
+                __fluent_libc_hp_##NAME##_atfork_parent,    \
+                __fluent_libc_hp_##NAME##_atfork_child      \
+            );                                              \
+            __fluent_libc_hg_##NAME##_has_put_atfork_guard = 1; \
         }                                                   \
+    }
+
+#else
+#   define __FLUENT_LIBC_HG_FORK_API(V, NAME) \
+        static inline void __fluent_libc_hp_##NAME##_register_atfork() {}
+#endif // _WIN32
+
+// ============= SNAPSHOTS =============
+// Binary dump of every live guard of a type, streamed with
+// writev() in batches instead of one write per object.
+//
+// Stream layout (host byte order):
+// [header] [record | payload * length]* [trailer]
+// The trailer holds the record count and an FNV-1a checksum
+// of everything before it; readers hand out no guard until
+// both have been verified. Records keep the count a guard had
+// when it was written, but its holders stayed in the writing
+// process: restored guards start at one reference, which the
+// read callback owns and must lower (or keep) itself.
+#ifndef _WIN32
+
+#ifndef IOV_MAX
+#   define IOV_MAX 1024
+#endif
+
+#define HEAP_GUARD_SNAPSHOT_MAGIC 0x31504E53474C4846ULL // "FLHGSNP1"
+#define HEAP_GUARD_SNAPSHOT_VERSION 2
+#define HEAP_GUARD_SNAPSHOT_RECORD 1
+#define HEAP_GUARD_SNAPSHOT_END 2
+#define HEAP_GUARD_SNAPSHOT_CONCURRENT 0x1
+#define HEAP_GUARD_SNAPSHOT_BATCH 512 // records per writev(), 2 iovecs each
+
+typedef struct __fluent_libc_hg_snapshot_header_t
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t payload_size;
+} __fluent_libc_hg_snapshot_header_t;
+
+typedef struct __fluent_libc_hg_snapshot_record_t
+{
+    uint32_t tag;
+    uint32_t flags;
+    uint64_t ref_count; // record count in the trailer
+    uint64_t length;    // payload elements
+} __fluent_libc_hg_snapshot_record_t;
+
+static inline uint64_t __fluent_libc_hg_fnv1a(uint64_t hash, const void *data, const size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+static inline int __fluent_libc_hg_writev_all(const int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        // Skip whatever the kernel already took
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+
+    return 0;
+}
+
+static inline int __fluent_libc_hg_read_all(const int fd, void *buf, size_t len)
+{
+    char *cursor = (char *)buf;
+    while (len > 0)
+    {
+        const ssize_t got = read(fd, cursor, len);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (got <= 0)
+        {
+            return -1;
+        }
+
+        cursor += got;
+        len -= (size_t)got;
+    }
+
+    return 0;
+}
+
+#define __FLUENT_LIBC_HG_SNAPSHOT_API(V, NAME) \
+    typedef void (*heap_##NAME##_snapshot_cb_t)(heap_guard_##NAME##_t *guard, void *ctx); \
                                                             \
-        if (__fluent_libc_hg_##NAME##_val_arena_allocator)  \
+    static inline long heap_##NAME##_snapshot_write(const int fd) \
+    {                                                       \
+        __fluent_libc_hg_snapshot_header_t header = { HEAP_GUARD_SNAPSHOT_MAGIC, HEAP_GUARD_SNAPSHOT_VERSION, (uint32_t)sizeof(V) }; \
+        uint64_t checksum = __fluent_libc_hg_fnv1a(0xCBF29CE484222325ULL, &header, sizeof(header)); \
+        struct iovec head_iov = { &header, sizeof(header) }; \
+        if (__fluent_libc_hg_writev_all(fd, &head_iov, 1) != 0) \
         {                                                   \
-            destroy_arena(__fluent_libc_hg_##NAME##_val_arena_allocator); \
+            return -1;                                      \
         }                                                   \
                                                             \
         if (__fluent_libc_impl_hg_##NAME##_mutex != NULL)   \
         {                                                   \
-            mutex_destroy(__fluent_libc_impl_hg_##NAME##_mutex); \
-            free(__fluent_libc_impl_hg_##NAME##_mutex);     \
-            __fluent_libc_impl_hg_##NAME##_mutex = NULL;    \
+            mutex_lock(__fluent_libc_impl_hg_##NAME##_mutex); \
+        }                                                   \
+                                                            \
+        __fluent_libc_hg_snapshot_record_t records[HEAP_GUARD_SNAPSHOT_BATCH]; \
+        struct iovec iov[HEAP_GUARD_SNAPSHOT_BATCH * 2];    \
+        uint64_t count = 0;                                 \
+        int batched = 0;                                    \
+        int status = 0;                                     \
+                                                            \
+        __fluent_libc_heap_##NAME##_tracker_t *current = __fluent_libc_impl_heap_##NAME##_guards; \
+        while (current != NULL && status == 0)              \
+        {                                                   \
+            const heap_guard_##NAME##_t *guard = current->guard; \
+            current = current->next;                        \
+                                                            \
+            if (guard == NULL || guard->ptr == NULL)        \
+            {                                               \
+                continue;                                   \
+            }                                               \
+                                                            \
+            __fluent_libc_hg_snapshot_record_t *record = &records[batched]; \
+            record->tag = HEAP_GUARD_SNAPSHOT_RECORD;       \
+            record->flags = guard->concurrent ? HEAP_GUARD_SNAPSHOT_CONCURRENT : 0; \
+            record->ref_count = guard->concurrent           \
+                ? atomic_size_load((atomic_size_t *)&guard->concurrent_ref) \
+                : guard->ref_count;                         \
+            record->length = guard->allocated;              \
+                                                            \
+            checksum = __fluent_libc_hg_fnv1a(checksum, record, sizeof(*record)); \
+            checksum = __fluent_libc_hg_fnv1a(checksum, guard->ptr, guard->allocated * sizeof(V)); \
+                                                            \
+            iov[batched * 2].iov_base = record;             \
+            iov[batched * 2].iov_len = sizeof(*record);     \
+            iov[batched * 2 + 1].iov_base = guard->ptr;     \
+            iov[batched * 2 + 1].iov_len = guard->allocated * sizeof(V); \
+            batched++;                                      \
+            count++;                                        \
+                                                            \
+            if (batched == HEAP_GUARD_SNAPSHOT_BATCH || batched * 2 >= IOV_MAX) \
+            {                                               \
+                status = __fluent_libc_hg_writev_all(fd, iov, batched * 2); \
+                batched = 0;                                \
+            }                                               \
         }                                                   \
                                                             \
-        if (__fluent_libc_hg_##NAME##_free_list != NULL) \
+        if (status == 0 && batched > 0)                     \
         {                                                   \
-            vec___fluent_libc_hp_fl_##NAME##_destroy(__fluent_libc_hg_##NAME##_free_list, NULL); \
-            __fluent_libc_hg_##NAME##_free_list = NULL;     \
+            status = __fluent_libc_hg_writev_all(fd, iov, batched * 2); \
         }                                                   \
                                                             \
-        if (__fluent_libc_hgh_##NAME##_free_list != NULL)   \
+        if (__fluent_libc_impl_hg_##NAME##_mutex != NULL)   \
         {                                                   \
-            vec___fluent_libc_hph_fl_##NAME##_destroy(__fluent_libc_hgh_##NAME##_free_list, NULL); \
-            __fluent_libc_hgh_##NAME##_free_list = NULL;    \
+            mutex_unlock(__fluent_libc_impl_hg_##NAME##_mutex); \
         }                                                   \
                                                             \
-        if (__fluent_libc_hgt_##NAME##_free_list != NULL)   \
+        __fluent_libc_hg_snapshot_record_t trailer = { HEAP_GUARD_SNAPSHOT_END, 0, count, 0 }; \
+        struct iovec tail_iov[2] = { { &trailer, sizeof(trailer) }, { &checksum, sizeof(checksum) } }; \
+        if (status != 0 || __fluent_libc_hg_writev_all(fd, tail_iov, 2) != 0) \
         {                                                   \
-            vec___fluent_libc_hpt_fl_##NAME##_destroy(__fluent_libc_hgt_##NAME##_free_list, NULL); \
-            __fluent_libc_hgt_##NAME##_free_list = NULL;    \
+            return -1;                                      \
         }                                                   \
+                                                            \
+        return (long)count;                                 \
     }                                                       \
                                                             \
-    static __fluent_libc_heap_##NAME##_tracker_t * __fluent_libc_hp_##NAME##_req_tracker() \
+    static inline long heap_##NAME##_snapshot_read(         \
+        const int fd,                                       \
+        const int insertion_concurrent,                     \
+        const heap_##NAME##_destructor_t destructor,        \
+        const heap_##NAME##_snapshot_cb_t callback,         \
+        void *ctx                                           \
+    )                                                       \
     {                                                       \
+        __fluent_libc_hg_snapshot_header_t header;          \
         if (                                                \
-            __fluent_libc_hgt_##NAME##_free_list == NULL || \
-            __fluent_libc_hgt_##NAME##_free_list->length == 0 \
+            __fluent_libc_hg_read_all(fd, &header, sizeof(header)) != 0 || \
+            header.magic != HEAP_GUARD_SNAPSHOT_MAGIC ||    \
+            header.version != HEAP_GUARD_SNAPSHOT_VERSION || \
+            header.payload_size != sizeof(V)                \
         )                                                   \
         {                                                   \
-            return (__fluent_libc_heap_##NAME##_tracker_t *)arena_malloc(__fluent_libc_hg_heap_##NAME##_arena_allocator); \
+            return -1;                                      \
         }                                                   \
                                                             \
-        return vec___fluent_libc_hpt_fl_##NAME##_pop(__fluent_libc_hgt_##NAME##_free_list); \
-    }                                                       \
+        uint64_t checksum = __fluent_libc_hg_fnv1a(0xCBF29CE484222325ULL, &header, sizeof(header)); \
+        heap_guard_##NAME##_t **loaded = NULL;              \
+        size_t count = 0;                                   \
+        size_t capacity = 0;                                \
+        int status = -1;                                    \
                                                             \
-    static heap_guard_##NAME##_t * __fluent_libc_hp_##NAME##_req_guard() \
-    {                                                       \
-        if (                                                \
-            __fluent_libc_hgh_##NAME##_free_list == NULL || \
-            __fluent_libc_hgh_##NAME##_free_list->length == 0 \
-        )                                                   \
+        for (;;)                                            \
         {                                                   \
-            return (heap_guard_##NAME##_t *)arena_malloc(__fluent_libc_hg_heap_##NAME##_arena_allocator); \
+            __fluent_libc_hg_snapshot_record_t record;      \
+            if (__fluent_libc_hg_read_all(fd, &record, sizeof(record)) != 0) \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (record.tag == HEAP_GUARD_SNAPSHOT_END)      \
+            {                                               \
+                uint64_t expected;                          \
+                if (                                        \
+                    __fluent_libc_hg_read_all(fd, &expected, sizeof(expected)) == 0 && \
+                    expected == checksum &&                 \
+                    record.ref_count == count               \
+                )                                           \
+                {                                           \
+                    status = 0;                             \
+                }                                           \
+                                                            \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (                                            \
+                record.tag != HEAP_GUARD_SNAPSHOT_RECORD || record.ref_count == 0 || \
+                record.length == 0 || record.length > SIZE_MAX / sizeof(V) \
+            )                                               \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            if (count == capacity)                          \
+            {                                               \
+                const size_t grown = capacity ? capacity * 2 : 64; \
+                heap_guard_##NAME##_t **resized = (heap_guard_##NAME##_t **)realloc(loaded, grown * sizeof(*loaded)); \
+                if (resized == NULL)                        \
+                {                                           \
+                    break;                                  \
+                }                                           \
+                                                            \
+                loaded = resized;                           \
+                capacity = grown;                           \
+            }                                               \
+                                                            \
+            const int concurrent = (record.flags & HEAP_GUARD_SNAPSHOT_CONCURRENT) != 0; \
+            const size_t length = (size_t)record.length;    \
+            heap_guard_##NAME##_t *guard = heap_##NAME##_alloc_array(length, concurrent, insertion_concurrent, destructor); \
+            if (guard == NULL)                              \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            loaded[count++] = guard;                        \
+            if (__fluent_libc_hg_read_all(fd, guard->ptr, length * sizeof(V)) != 0) \
+            {                                               \
+                break;                                      \
+            }                                               \
+                                                            \
+            checksum = __fluent_libc_hg_fnv1a(checksum, &record, sizeof(record)); \
+            checksum = __fluent_libc_hg_fnv1a(checksum, guard->ptr, length * sizeof(V)); \
         }                                                   \
                                                             \
-        return vec___fluent_libc_hph_fl_##NAME##_pop(__fluent_libc_hgh_##NAME##_free_list); \
-    }                                                       \
+        for (size_t i = 0; i < count; i++)                  \
+        {                                                   \
+            if (status == 0)                                \
+            {                                               \
+                /* The callback owns the guard's only reference */ \
+                if (callback != NULL)                       \
+                {                                           \
+                    callback(loaded[i], ctx);               \
+                }                                           \
                                                             \
-    static V *__fluent_libc_hp_##NAME##_req_ptr()           \
+                continue;                                   \
+            }                                               \
+                                                            \
+            /* Corrupt or truncated stream, undo everything */ \
+            heap_guard_##NAME##_t *guard = loaded[i];       \
+            guard->destructor = NULL;                       \
+            lower_guard_##NAME(&guard, insertion_concurrent); \
+        }                                                   \
+                                                            \
+        free(loaded);                                       \
+        return status == 0 ? (long)count : -1;              \
+    }
+
+#else
+#   define __FLUENT_LIBC_HG_SNAPSHOT_API(V, NAME)
+#endif // _WIN32
+
+// ============= PERSISTENT REGIONS =============
+// A region is a fixed-capacity slot heap that lives in a
+// file-backed mapping and only refers to its own memory
+// through offsets, so the same bytes stay valid no matter
+// where a later process maps them.
+//
+// Layout: [header | slot 0 | slot 1 | ...], each slot being
+// [ref count | free-list link | payload]. A handle is the
+// byte offset of a slot from the region base, 0 meaning none.
+#ifndef _WIN32
+
+#define HEAP_GUARD_REGION_MAGIC 0x31474552474C4846ULL // "FLHGREG1"
+#define HEAP_GUARD_REGION_VERSION 1
+#define HEAP_GUARD_REGION_ALIGN 16
+#define HEAP_GUARD_NULL_HANDLE ((heap_guard_handle_t)0)
+
+typedef uint64_t heap_guard_handle_t;
+
+typedef struct __fluent_libc_hg_region_header_t
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t payload_size;
+    uint64_t capacity;
+    _Atomic uint64_t bump;
+    _Atomic uint64_t free_head; // (ABA tag << 32) | (slot index + 1)
+    _Atomic uint64_t live;
+    _Atomic uint64_t root;
+} __fluent_libc_hg_region_header_t;
+
+typedef struct __fluent_libc_hg_region_slot_t
+{
+    _Atomic uint64_t ref_count;
+    _Atomic uint64_t next; // slot index + 1, 0 ends the list
+} __fluent_libc_hg_region_slot_t;
+
+typedef struct heap_guard_region_t
+{
+    unsigned char *base;
+    size_t map_size;
+    int fd;
+} heap_guard_region_t;
+
+static inline size_t __fluent_libc_hg_region_slot_size(const size_t payload_size)
+{
+    const size_t raw = sizeof(__fluent_libc_hg_region_slot_t) + payload_size;
+    return (raw + HEAP_GUARD_REGION_ALIGN - 1) & ~(size_t)(HEAP_GUARD_REGION_ALIGN - 1);
+}
+
+static inline __fluent_libc_hg_region_header_t *__fluent_libc_hg_region_header(const heap_guard_region_t *region)
+{
+    return (__fluent_libc_hg_region_header_t *)region->base;
+}
+
+static inline __fluent_libc_hg_region_slot_t *__fluent_libc_hg_region_slot(
+    const heap_guard_region_t *region,
+    const uint64_t index
+)
+{
+    const __fluent_libc_hg_region_header_t *header = __fluent_libc_hg_region_header(region);
+    return (__fluent_libc_hg_region_slot_t *)(region->base + sizeof(*header) + index * header->slot_size);
+}
+
+static inline uint64_t __fluent_libc_hg_region_index(
+    const heap_guard_region_t *region,
+    const heap_guard_handle_t handle
+)
+{
+    const __fluent_libc_hg_region_header_t *header = __fluent_libc_hg_region_header(region);
+    return (handle - sizeof(*header)) / header->slot_size;
+}
+
+static inline void *__fluent_libc_hg_region_resolve(
+    const heap_guard_region_t *region,
+    const heap_guard_handle_t handle
+)
+{
+    if (handle == HEAP_GUARD_NULL_HANDLE || region->base == NULL)
+    {
+        return NULL;
+    }
+
+    return region->base + handle + sizeof(__fluent_libc_hg_region_slot_t);
+}
+
+/**
+ * Maps the region stored in `fd`.
+ *
+ * An empty file is grown to `capacity` slots of
+ * `payload_size` bytes and formatted. A file that
+ * already holds a region must have been formatted for
+ * the same payload size, its own capacity is kept.
+ *
+ * Returns 1 if an existing region was resumed, 0 if
+ * a new one was formatted and -1 on failure.
+ */
+static inline int __fluent_libc_hg_region_map(
+    heap_guard_region_t *region,
+    const int fd,
+    const size_t payload_size,
+    const size_t capacity
+)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        return -1;
+    }
+
+    const size_t slot_size = __fluent_libc_hg_region_slot_size(payload_size);
+    size_t map_size = (size_t)st.st_size;
+
+    if (map_size == 0)
+    {
+        // Slot indices are packed in 32 bits next to the ABA tag
+        if (capacity == 0 || capacity >= UINT32_MAX)
+        {
+            return -1;
+        }
+
+        map_size = sizeof(__fluent_libc_hg_region_header_t) + capacity * slot_size;
+        if (ftruncate(fd, (off_t)map_size) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (map_size < sizeof(__fluent_libc_hg_region_header_t) + slot_size)
+    {
+        return -1;
+    }
+
+    void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    __fluent_libc_hg_region_header_t *header = (__fluent_libc_hg_region_header_t *)base;
+
+    int resumed = 1;
+
+    // A zeroed header means a fresh file or a format that never
+    // completed; the magic is written last so both look the same
+    if (header->magic == 0)
+    {
+        header->version = HEAP_GUARD_REGION_VERSION;
+        header->slot_size = (uint32_t)slot_size;
+        header->payload_size = payload_size;
+        header->capacity = (map_size - sizeof(*header)) / slot_size;
+        atomic_init(&header->bump, 0);
+        atomic_init(&header->free_head, 0);
+        atomic_init(&header->live, 0);
+        atomic_init(&header->root, HEAP_GUARD_NULL_HANDLE);
+
+        atomic_thread_fence(memory_order_release);
+        header->magic = HEAP_GUARD_REGION_MAGIC;
+        resumed = 0;
+    }
+    else if (
+        header->magic != HEAP_GUARD_REGION_MAGIC ||
+        header->version != HEAP_GUARD_REGION_VERSION ||
+        header->payload_size != payload_size ||
+        header->slot_size != slot_size ||
+        header->capacity >= UINT32_MAX ||
+        map_size < sizeof(*header) + header->capacity * slot_size
+    )
+    {
+        munmap(base, map_size);
+        return -1;
+    }
+
+    region->base = (unsigned char *)base;
+    region->map_size = map_size;
+    region->fd = fd;
+    return resumed;
+}
+
+static inline void __fluent_libc_hg_region_unmap(heap_guard_region_t *region)
+{
+    if (region->base != NULL)
+    {
+        munmap(region->base, region->map_size);
+    }
+
+    region->base = NULL;
+    region->map_size = 0;
+    region->fd = -1;
+}
+
+static inline heap_guard_handle_t __fluent_libc_hg_region_alloc(heap_guard_region_t *region)
+{
+    __fluent_libc_hg_region_header_t *header = __fluent_libc_hg_region_header(region);
+    __fluent_libc_hg_region_slot_t *slot = NULL;
+    uint64_t index;
+
+    // Recycle a released slot first
+    uint64_t head = atomic_load_explicit(&header->free_head, memory_order_acquire);
+    while ((head & UINT32_MAX) != 0)
+    {
+        index = (head & UINT32_MAX) - 1;
+        slot = __fluent_libc_hg_region_slot(region, index);
+
+        const uint64_t next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        const uint64_t desired = ((head >> 32) + 1) << 32 | next;
+
+        if (atomic_compare_exchange_weak_explicit(
+            &header->free_head, &head, desired,
+            memory_order_acq_rel, memory_order_acquire
+        ))
+        {
+            break;
+        }
+
+        slot = NULL;
+    }
+
+    // Otherwise carve a slot that was never handed out
+    if (slot == NULL)
+    {
+        index = atomic_load_explicit(&header->bump, memory_order_relaxed);
+        do
+        {
+            if (index >= header->capacity)
+            {
+                return HEAP_GUARD_NULL_HANDLE;
+            }
+        } while (!atomic_compare_exchange_weak_explicit(
+            &header->bump, &index, index + 1,
+            memory_order_relaxed, memory_order_relaxed
+        ));
+
+        slot = __fluent_libc_hg_region_slot(region, index);
+    }
+
+    atomic_store_explicit(&slot->ref_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&header->live, 1, memory_order_relaxed);
+    return (heap_guard_handle_t)((unsigned char *)slot - region->base);
+}
+
+static inline void __fluent_libc_hg_region_raise(
+    const heap_guard_region_t *region,
+    const heap_guard_handle_t handle
+)
+{
+    __fluent_libc_hg_region_slot_t *slot = (__fluent_libc_hg_region_slot_t *)(region->base + handle);
+    atomic_fetch_add_explicit(&slot->ref_count, 1, memory_order_relaxed);
+}
+
+/**
+ * Drops one reference to `handle`, returning the slot to
+ * the free list once none are left.
+ *
+ * Returns 1 if the slot was released, 0 otherwise.
+ */
+static inline int __fluent_libc_hg_region_lower(
+    heap_guard_region_t *region,
+    const heap_guard_handle_t handle
+)
+{
+    __fluent_libc_hg_region_header_t *header = __fluent_libc_hg_region_header(region);
+    __fluent_libc_hg_region_slot_t *slot = (__fluent_libc_hg_region_slot_t *)(region->base + handle);
+
+    if (atomic_fetch_sub_explicit(&slot->ref_count, 1, memory_order_acq_rel) != 1)
+    {
+        return 0;
+    }
+
+    const uint64_t index = __fluent_libc_hg_region_index(region, handle);
+    uint64_t head = atomic_load_explicit(&header->free_head, memory_order_relaxed);
+    uint64_t desired;
+
+    do
+    {
+        atomic_store_explicit(&slot->next, head & UINT32_MAX, memory_order_relaxed);
+        desired = ((head >> 32) + 1) << 32 | (index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &header->free_head, &head, desired,
+        memory_order_release, memory_order_relaxed
+    ));
+
+    atomic_fetch_sub_explicit(&header->live, 1, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * Creates the shared memory object backing a shared heap.
+ *
+ * A NULL `name` creates an anonymous object (a memfd on
+ * Linux) that can only be reached through its descriptor,
+ * either inherited across fork() or passed with SCM_RIGHTS.
+ */
+static inline int __fluent_libc_hg_shm_create(const char *name)
+{
+    if (name != NULL)
+    {
+        return shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    return memfd_create("heap_guard", MFD_CLOEXEC);
+#else
+    // Emulate an anonymous object by unlinking it right away
+    char tmp_name[64];
+    snprintf(tmp_name, sizeof(tmp_name), "/heap_guard.%ld.%p", (long)getpid(), (void *)&tmp_name);
+
+    const int fd = shm_open(tmp_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd >= 0)
+    {
+        shm_unlink(tmp_name);
+    }
+
+    return fd;
+#endif
+}
+
+// ============= REGION MACROS =============
+// Handle API shared by persistent and shared-memory heaps,
+// KIND being the function infix (persist, shared).
+#define __FLUENT_LIBC_HG_REGION_API(V, NAME, KIND) \
+    static inline heap_guard_handle_t heap_##NAME##_##KIND##_alloc() \
     {                                                       \
-        if (                                                \
-            __fluent_libc_hg_##NAME##_free_list == NULL ||  \
-            __fluent_libc_hg_##NAME##_free_list->length == 0 \
-        )                                                   \
+        if (__fluent_libc_hg_##NAME##_##KIND##_region.base == NULL) \
         {                                                   \
-            return (V *)arena_malloc(__fluent_libc_hg_##NAME##_arena_allocator); \
+            return HEAP_GUARD_NULL_HANDLE;                  \
         }                                                   \
                                                             \
-        return vec___fluent_libc_hp_fl_##NAME##_pop(__fluent_libc_hg_##NAME##_free_list); \
+        return __fluent_libc_hg_region_alloc(&__fluent_libc_hg_##NAME##_##KIND##_region); \
     }                                                       \
                                                             \
-    static inline heap_guard_##NAME##_t *heap_##NAME##_alloc( \
-        const int is_concurrent,                            \
-        const int insertion_concurrent,                     \
-        const heap_##NAME##_destructor_t destructor,        \
-        V *default_ptr                                      \
-    )                                                       \
+    static inline V *heap_##NAME##_##KIND##_resolve(const heap_guard_handle_t handle) \
+    {                                                       \
+        return (V *)__fluent_libc_hg_region_resolve(&__fluent_libc_hg_##NAME##_##KIND##_region, handle); \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_##KIND##_raise(const heap_guard_handle_t handle) \
     {                                                       \
-        if (__fluent_libc_hg_##NAME##_arena_allocator == NULL) \
+        if (handle != HEAP_GUARD_NULL_HANDLE)               \
         {                                                   \
-            __fluent_libc_hg_##NAME##_arena_allocator = arena_new(ARENA_SIZE, sizeof(V)); \
+            __fluent_libc_hg_region_raise(&__fluent_libc_hg_##NAME##_##KIND##_region, handle); \
         }                                                   \
+    }                                                       \
                                                             \
-        if (__fluent_libc_hg_heap_##NAME##_arena_allocator == NULL) \
+    static inline void heap_##NAME##_##KIND##_lower(heap_guard_handle_t *handle_ptr) \
+    {                                                       \
+        if (handle_ptr == NULL || *handle_ptr == HEAP_GUARD_NULL_HANDLE) \
         {                                                   \
-            __fluent_libc_hg_heap_##NAME##_arena_allocator = arena_new(ARENA_SIZE, sizeof(__fluent_libc_heap_##NAME##_tracker_t)); \
+            return;                                         \
         }                                                   \
                                                             \
-        if (__fluent_libc_hg_##NAME##_val_arena_allocator == NULL) \
+        if (__fluent_libc_hg_region_lower(&__fluent_libc_hg_##NAME##_##KIND##_region, *handle_ptr)) \
         {                                                   \
-            __fluent_libc_hg_##NAME##_val_arena_allocator = arena_new(ARENA_SIZE, sizeof(V)); \
+            *handle_ptr = HEAP_GUARD_NULL_HANDLE;           \
         }                                                   \
+    }                                                       \
                                                             \
-        heap_guard_##NAME##_t *guard = __fluent_libc_hp_##NAME##_req_guard(); \
-        if (guard == NULL)                                  \
+    static inline heap_guard_handle_t heap_##NAME##_##KIND##_root() \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_##KIND##_region.base == NULL) \
         {                                                   \
-            return NULL;                                    \
+            return HEAP_GUARD_NULL_HANDLE;                  \
         }                                                   \
                                                             \
-        guard->ptr = default_ptr ? default_ptr : __fluent_libc_hp_##NAME##_req_ptr(); \
-        if (guard->ptr == NULL)                             \
+        return atomic_load_explicit(&__fluent_libc_hg_region_header(&__fluent_libc_hg_##NAME##_##KIND##_region)->root, memory_order_acquire); \
+    }                                                       \
+                                                            \
+    static inline void heap_##NAME##_##KIND##_set_root(const heap_guard_handle_t handle) \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_##KIND##_region.base != NULL) \
         {                                                   \
-            return NULL;                                    \
+            atomic_store_explicit(&__fluent_libc_hg_region_header(&__fluent_libc_hg_##NAME##_##KIND##_region)->root, handle, memory_order_release); \
         }                                                   \
+    }                                                       \
                                                             \
-        guard->ref_count = 1;                               \
-        guard->concurrent = is_concurrent;                  \
-        guard->destructor = destructor;                     \
+    static inline void heap_##NAME##_##KIND##_close()       \
+    {                                                       \
+        const int fd = __fluent_libc_hg_##NAME##_##KIND##_region.fd; \
+        __fluent_libc_hg_region_unmap(&__fluent_libc_hg_##NAME##_##KIND##_region); \
                                                             \
-        if (is_concurrent)                                  \
+        if (fd >= 0)                                        \
         {                                                   \
-            atomic_size_t counter;                          \
-            atomic_size_init(&counter, 1);                  \
-            guard->concurrent_ref = counter;                \
+            close(fd);                                      \
         }                                                   \
+    }
+
+// ============= PERSISTENT MACRO =============
+// Generates a file-backed heap for V whose objects survive
+// process restarts. V must not contain raw pointers; store
+// heap_guard_handle_t values instead, and publish the entry
+// point of your object graph with the root handle.
+//
+// Usage:
+// ----------------------------------------
+// DEFINE_HEAP_GUARD_PERSISTENT(my_record_t, record);
+//
+// if (heap_record_persist_open("records.heap", 1 << 20) == 0)
+// {
+//     // Fresh file, build the object graph once
+//     heap_guard_handle_t root = heap_record_persist_alloc();
+//     heap_record_persist_resolve(root)->id = 1;
+//     heap_record_persist_set_root(root);
+// }
+//
+// // Warm restart, objects are already in place
+// my_record_t *first = heap_record_persist_resolve(heap_record_persist_root());
+#define DEFINE_HEAP_GUARD_PERSISTENT(V, NAME) \
+    _Static_assert(_Alignof(V) <= HEAP_GUARD_REGION_ALIGN, "persistent payloads cannot be over-aligned"); \
                                                             \
-        if (__fluent_libc_hg_##NAME##_has_put_atexit_guard) \
+    heap_guard_region_t __fluent_libc_hg_##NAME##_persist_region = { NULL, 0, -1 }; \
+                                                            \
+    static inline int heap_##NAME##_persist_open(           \
+        const char *path,                                   \
+        const size_t capacity                               \
+    )                                                       \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_persist_region.base != NULL) \
         {                                                   \
-            atexit(__fluent_libc_hp_##NAME##_destroy);      \
-            __fluent_libc_hg_##NAME##_has_put_atexit_guard = 1; \
+            return -1;                                      \
         }                                                   \
                                                             \
-        if (insertion_concurrent)                           \
+        const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600); \
+        if (fd < 0)                                         \
         {                                                   \
-            if (__fluent_libc_impl_hg_##NAME##_mutex == NULL) \
-            {                                               \
-                __fluent_libc_impl_hg_##NAME##_mutex = (mutex_t *)malloc(sizeof(mutex_t)); \
-                if (__fluent_libc_impl_hg_##NAME##_mutex == NULL) \
-                {                                           \
-                    return NULL;                            \
-                }                                           \
-                                                            \
-                mutex_init(__fluent_libc_impl_hg_##NAME##_mutex); \
-            }                                               \
-                                                            \
-            mutex_lock(__fluent_libc_impl_hg_##NAME##_mutex); \
+            return -1;                                      \
         }                                                   \
                                                             \
-        if (__fluent_libc_impl_heap_##NAME##_guards == NULL) \
+        const int status = __fluent_libc_hg_region_map(&__fluent_libc_hg_##NAME##_persist_region, fd, sizeof(V), capacity); \
+        if (status < 0)                                     \
         {                                                   \
-            __fluent_libc_impl_heap_##NAME##_guards = __fluent_libc_hp_##NAME##_req_tracker(); \
-            if (__fluent_libc_impl_heap_##NAME##_guards == NULL) \
-            {                                               \
-                if (insertion_concurrent && __fluent_libc_impl_hg_##NAME##_mutex != NULL) \
-                {                                           \
-                    mutex_unlock(__fluent_libc_impl_hg_##NAME##_mutex); \
-                }                                           \
+            close(fd);                                      \
+        }                                                   \
                                                             \
-                vec___fluent_libc_hph_fl_##NAME##_push(__fluent_libc_hgh_##NAME##_free_list, guard); \
-                vec___fluent_libc_hp_fl_##NAME##_push(__fluent_libc_hg_##NAME##_free_list, guard->ptr); \
-                return NULL;                                \
-            }                                               \
+        return status;                                      \
+    }                                                       \
                                                             \
-            guard->__tracker = __fluent_libc_impl_heap_##NAME##_guards; \
-            __fluent_libc_impl_heap_##NAME##_guards->guard = guard; \
-            __fluent_libc_impl_heap_##NAME##_guards->tail = NULL; \
-            __fluent_libc_impl_heap_##NAME##_guards->next = NULL; \
-            __fluent_libc_impl_heap_##NAME##_guards->prev = NULL; \
-        } else                                              \
+    static inline int heap_##NAME##_persist_sync(const int async) \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_persist_region.base == NULL) \
         {                                                   \
-            __fluent_libc_heap_##NAME##_tracker_t *node = __fluent_libc_hp_##NAME##_req_tracker(); \
-                                                            \
-            if (node == NULL)                               \
-            {                                               \
-                if (insertion_concurrent && __fluent_libc_impl_hg_##NAME##_mutex != NULL) \
-                {                                           \
-                    mutex_unlock(__fluent_libc_impl_hg_##NAME##_mutex); \
-                }                                           \
+            return -1;                                      \
+        }                                                   \
                                                             \
-                vec___fluent_libc_hph_fl_##NAME##_push(__fluent_libc_hgh_##NAME##_free_list, guard); \
-                vec___fluent_libc_hp_fl_##NAME##_push(__fluent_libc_hg_##NAME##_free_list, guard->ptr); \
-                return NULL;                                \
-            }                                               \
+        return msync(                                       \
+            __fluent_libc_hg_##NAME##_persist_region.base,  \
+            __fluent_libc_hg_##NAME##_persist_region.map_size, \
+            async ? MS_ASYNC : MS_SYNC                      \
+        );                                                  \
+    }                                                       \
                                                             \
-            guard->__tracker = node;                        \
-            node->guard = guard;                            \
-            node->next = NULL;                              \
+    __FLUENT_LIBC_HG_REGION_API(V, NAME, persist)
+
+// ============= SHARED MACRO =============
+// Generates a heap for V that lives in POSIX shared memory
+// (or an anonymous memfd on Linux) so several processes can
+// map the same objects and reference count them together.
+// Same payload rules as persistent heaps: handles, not
+// pointers, because every process maps at its own address.
+//
+// Usage:
+// ----------------------------------------
+// DEFINE_HEAP_GUARD_SHARED(my_row_t, row);
+//
+// // Master, before forking workers
+// heap_row_shared_create("/rows", 1 << 20);
+// heap_guard_handle_t table = heap_row_shared_alloc();
+// heap_row_shared_set_root(table);
+//
+// // Unrelated worker process
+// heap_row_shared_open("/rows");
+// my_row_t *rows = heap_row_shared_resolve(heap_row_shared_root());
+#define DEFINE_HEAP_GUARD_SHARED(V, NAME) \
+    _Static_assert(_Alignof(V) <= HEAP_GUARD_REGION_ALIGN, "shared payloads cannot be over-aligned"); \
+    _Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared heaps need address-free 64-bit atomics"); \
                                                             \
-            if (__fluent_libc_impl_heap_##NAME##_guards->tail == NULL) \
-            {                                               \
-                __fluent_libc_impl_heap_##NAME##_guards->next = node; \
-                __fluent_libc_impl_heap_##NAME##_guards->tail = node; \
-                node->prev = NULL;                          \
-            } else                                          \
-            {                                               \
-                __fluent_libc_impl_heap_##NAME##_guards->tail->next = node; \
-                node->prev = __fluent_libc_impl_heap_##NAME##_guards->tail; \
-                __fluent_libc_impl_heap_##NAME##_guards->tail = node; \
-            }                                               \
-        }                                                   \
+    heap_guard_region_t __fluent_libc_hg_##NAME##_shared_region = { NULL, 0, -1 }; \
                                                             \
-        if (insertion_concurrent && __fluent_libc_impl_hg_##NAME##_mutex != NULL) \
+    static inline int heap_##NAME##_shared_attach(const int fd) \
+    {                                                       \
+        if (__fluent_libc_hg_##NAME##_shared_region.base != NULL) \
         {                                                   \
-            mutex_unlock(__fluent_libc_impl_hg_##NAME##_mutex); \
+            return -1;                                      \
         }                                                   \
                                                             \
-        return guard;                                       \
+        return __fluent_libc_hg_region_map(&__fluent_libc_hg_##NAME##_shared_region, fd, sizeof(V), 0) < 0 ? -1 : 0; \
     }                                                       \
                                                             \
-    static inline void lower_guard_##NAME(                  \
-        heap_guard_##NAME##_t **guard_ptr,                  \
-        const int insertion_concurrent                      \
+    static inline int heap_##NAME##_shared_create(          \
+        const char *name,                                   \
+        const size_t capacity                               \
     )                                                       \
     {                                                       \
-        if (guard_ptr == NULL || *guard_ptr == NULL)        \
+        if (__fluent_libc_hg_##NAME##_shared_region.base != NULL) \
         {                                                   \
-            return;                                         \
+            return -1;                                      \
         }                                                   \
                                                             \
-        heap_guard_##NAME##_t *guard = *guard_ptr;          \
-                                                            \
-        int free_memory = 0;                                \
-        if (guard->concurrent)                              \
-        {                                                   \
-            atomic_size_fetch_sub(&guard->concurrent_ref, 1); \
-            free_memory = atomic_size_load(&guard->concurrent_ref) == 0; \
-        }                                                   \
-        else                                                \
+        const int fd = __fluent_libc_hg_shm_create(name);   \
+        if (fd < 0)                                         \
         {                                                   \
-            guard->ref_count--;                             \
-            free_memory = guard->ref_count == 0;            \
+            return -1;                                      \
         }                                                   \
                                                             \
-        if (free_memory == 1)                               \
+        if (__fluent_libc_hg_region_map(&__fluent_libc_hg_##NAME##_shared_region, fd, sizeof(V), capacity) < 0) \
         {                                                   \
-            if (insertion_concurrent && __fluent_libc_impl_hg_##NAME##_mutex != NULL) \
+            close(fd);                                      \
+            if (name != NULL)                               \
             {                                               \
-                mutex_lock(__fluent_libc_impl_hg_##NAME##_mutex); \
+                shm_unlink(name);                           \
             }                                               \
                                                             \
-            __fluent_libc_heap_##NAME##_tracker_t *tracker = (__fluent_libc_heap_##NAME##_tracker_t *)guard->__tracker; \
-                                                            \
-            if (__fluent_libc_impl_heap_##NAME##_guards->tail == tracker) \
-            {                                               \
-                __fluent_libc_impl_heap_##NAME##_guards->tail = tracker->prev; \
-            }                                               \
+            return -1;                                      \
+        }                                                   \
                                                             \
-            else if (__fluent_libc_impl_heap_##NAME##_guards == tracker) \
-            {                                               \
-                __fluent_libc_impl_heap_##NAME##_guards = tracker->next; \
-            }                                               \
+        return 0;                                           \
+    }                                                       \
                                                             \
-            if (tracker->prev != NULL)                      \
-            {                                               \
-                tracker->prev->next = tracker->next;        \
+    static inline int heap_##NAME##_shared_open(const char *name) \
+    {                                                       \
+        const int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0); \
+        if (fd < 0)                                         \
+        {                                                   \
+            return -1;                                      \
+        }                                                   \
                                                             \
-                if (tracker->next != NULL)                  \
-                {                                           \
-                    tracker->next->prev = tracker->prev;    \
-                }                                           \
-            }                                               \
+        if (heap_##NAME##_shared_attach(fd) != 0)           \
+        {                                                   \
+            close(fd);                                      \
+            return -1;                                      \
+        }                                                   \
                                                             \
-            vec___fluent_libc_hpt_fl_##NAME##_push(__fluent_libc_hgt_##NAME##_free_list, tracker); \
+        return 0;                                           \
+    }                                                       \
                                                             \
-            drop_guard_##NAME(guard_ptr, 0);                \
+    static inline int heap_##NAME##_shared_fd()             \
+    {                                                       \
+        return __fluent_libc_hg_##NAME##_shared_region.fd;  \
+    }                                                       \
                                                             \
-            if (insertion_concurrent && __fluent_libc_impl_hg_##NAME##_mutex != NULL) \
-            {                                               \
-                mutex_unlock(__fluent_libc_impl_hg_##NAME##_mutex); \
-            }                                               \
-        }                                                   \
-    }
+    __FLUENT_LIBC_HG_REGION_API(V, NAME, shared)
+
+#endif // _WIN32
+
 // ============= FLUENT LIB C++ =============
 #if defined(__cplusplus)
 }
@@ -0,0 +1,118 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+
+DEFINE_HEAP_GUARD(long, entry, 64);
+DEFINE_HEAP_GUARD_MAP(long, entry);
+
+// Twice as many live threads as there are records, every one of
+// them having been through a critical section before the barrier
+#define THREADS (2 * HEAP_GUARD_EPOCH_THREADS + 1)
+#define WAVES 2
+#define SHARED_KEYS 64
+
+static guard_map_entry_t map;
+static pthread_barrier_t barrier;
+
+static int insert_key(const uint64_t key)
+{
+    heap_guard_entry_t *guard = heap_entry_alloc(1, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    *guard->ptr = (long)key;
+    const int status = guard_map_entry_insert(&map, key, guard);
+    lower_guard_entry(&guard, 1);
+    return status;
+}
+
+static void read_shared(const uint64_t key)
+{
+    heap_guard_entry_t *guard = guard_map_entry_get(&map, key % SHARED_KEYS);
+    CHECK(guard != NULL);
+    CHECK(*guard->ptr == (long)(key % SHARED_KEYS));
+    lower_guard_entry(&guard, 1);
+}
+
+static void *run(void *arg)
+{
+    const uint64_t id = (uint64_t)(uintptr_t)arg;
+    read_shared(id);
+
+    // Everyone is alive here at once, none of them inside a
+    // critical section
+    pthread_barrier_wait(&barrier);
+
+    // Own key in and out, so the epochs have something to reclaim
+    const uint64_t key = SHARED_KEYS + id;
+    CHECK(insert_key(key) == 0);
+    read_shared(id + 1);
+    CHECK(guard_map_entry_remove(&map, key) == 0);
+    return NULL;
+}
+
+static size_t records_in_use()
+{
+    size_t used = 0;
+    for (size_t i = 0; i < HEAP_GUARD_EPOCH_THREADS; i++)
+    {
+        used += (size_t)atomic_load(&__fluent_libc_hg_epoch.records[i].in_use);
+    }
+    return used;
+}
+
+int main()
+{
+    CHECK(guard_map_entry_init(&map, SHARED_KEYS + THREADS, 1) == 0);
+    for (uint64_t key = 0; key < SHARED_KEYS; key++)
+    {
+        CHECK(insert_key(key) == 0);
+    }
+
+    pthread_attr_t attr;
+    CHECK(pthread_attr_init(&attr) == 0);
+    CHECK(pthread_attr_setstacksize(&attr, 256 * 1024) == 0);
+
+    static pthread_t threads[THREADS];
+    for (size_t wave = 0; wave < WAVES; wave++)
+    {
+        CHECK(pthread_barrier_init(&barrier, NULL, THREADS) == 0);
+        for (uintptr_t i = 0; i < THREADS; i++)
+        {
+            CHECK(pthread_create(&threads[i], &attr, run, (void *)i) == 0);
+        }
+        for (size_t i = 0; i < THREADS; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_barrier_destroy(&barrier);
+
+        // Threads outside a critical section hold no record
+        CHECK(records_in_use() == 0);
+        CHECK(guard_map_entry_count(&map) == SHARED_KEYS);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    // Nested sections keep the outermost record
+    heap_guard_epoch_enter();
+    heap_guard_epoch_enter();
+    CHECK(records_in_use() == 1);
+    heap_guard_epoch_exit();
+    CHECK(records_in_use() == 1);
+    heap_guard_epoch_exit();
+    CHECK(records_in_use() == 0);
+
+    guard_map_entry_destroy(&map);
+    heap_guard_epoch_synchronize();
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+
+// Larger than HEAP_GUARD_INLINE_MAX, so payloads come from their own slab
+typedef struct
+{
+    long value[4];
+} item_t;
+
+DEFINE_HEAP_GUARD(item_t, item, 64);
+DEFINE_HEAP_GUARD(item_t, late, 64);
+
+#define THREADS 8
+#define ROUNDS 200
+#define BATCH 64
+
+static void check_clean()
+{
+    // Nothing charged, nothing tracked, every block empty
+    CHECK(heap_item_usage() == 0);
+    CHECK(__fluent_libc_impl_heap_item_guards == NULL);
+    heap_item_trim();
+    CHECK(heap_item_footprint() == 0);
+}
+
+static void check_site(const size_t site)
+{
+    // Empty slabs, so the block site is reached as well
+    heap_item_trim();
+
+    heap_guard_fault_inject(site, 1);
+    heap_guard_item_t *guard = heap_item_alloc(0, 1, NULL, NULL);
+    const size_t hits = heap_guard_fault_hits();
+    heap_guard_fault_clear();
+
+    CHECK(guard == NULL);
+    CHECK(hits > 0);
+    check_clean();
+
+    // The pool is usable again once the site stops failing
+    guard = heap_item_alloc(0, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    guard->ptr->value[0] = 1;
+    lower_guard_item(&guard, 1);
+    check_clean();
+}
+
+static void check_mutex_site()
+{
+    // The registry mutex is only created on a type's first use
+    heap_guard_fault_inject(HEAP_GUARD_FAULT_MUTEX, 1);
+    heap_guard_late_t *guard = heap_late_alloc(0, 1, NULL, NULL);
+    CHECK(guard == NULL);
+    CHECK(heap_guard_fault_hits() == 1);
+    heap_guard_fault_clear();
+
+    guard = heap_late_alloc(0, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    lower_guard_late(&guard, 1);
+    CHECK(heap_late_usage() == 0);
+}
+
+static void *worker(void *arg)
+{
+    const size_t seed = (size_t)arg;
+    heap_guard_item_t *guards[BATCH];
+    size_t allocated = 0;
+
+    for (size_t round = 0; round < ROUNDS; round++)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < BATCH; i++)
+        {
+            heap_guard_item_t *guard = heap_item_alloc((int)((seed + i) & 1), 1, NULL, NULL);
+            if (guard != NULL)
+            {
+                guard->ptr->value[0] = (long)i;
+                guards[count++] = guard;
+            }
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            lower_guard_item(&guards[i], 1);
+        }
+
+        allocated += count;
+    }
+
+    return (void *)allocated;
+}
+
+static void check_threads(const size_t sites, const size_t every)
+{
+    heap_item_trim();
+    heap_guard_fault_inject(sites, every);
+
+    pthread_t threads[THREADS];
+    for (size_t i = 0; i < THREADS; i++)
+    {
+        CHECK(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+    }
+
+    size_t allocated = 0;
+    for (size_t i = 0; i < THREADS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        allocated += (size_t)result;
+    }
+
+    const size_t hits = heap_guard_fault_hits();
+    heap_guard_fault_clear();
+
+    // Some allocations failed, the rest went through, none leaked
+    CHECK(hits > 0);
+    CHECK(allocated > 0 && allocated < THREADS * ROUNDS * BATCH);
+    check_clean();
+}
+
+int main()
+{
+    check_site(HEAP_GUARD_FAULT_BLOCK);
+    check_site(HEAP_GUARD_FAULT_GUARD);
+    check_site(HEAP_GUARD_FAULT_PAYLOAD);
+    check_site(HEAP_GUARD_FAULT_TRACKER);
+    check_mutex_site();
+
+    check_threads(HEAP_GUARD_FAULT_GUARD, 5);
+    check_threads(HEAP_GUARD_FAULT_PAYLOAD, 5);
+    check_threads(HEAP_GUARD_FAULT_TRACKER, 5);
+    check_threads(HEAP_GUARD_FAULT_ALL, 7);
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+
+DEFINE_HEAP_GUARD(long, entry, 64);
+DEFINE_HEAP_GUARD_CACHE(long, entry);
+
+#define THREADS 4
+#define OPS 20000
+
+static guard_cache_entry_t cache;
+static size_t charge;
+
+static int put_key(const uint64_t key)
+{
+    heap_guard_entry_t *guard = heap_entry_alloc(1, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    *guard->ptr = (long)key;
+    const int status = guard_cache_entry_put(&cache, key, guard);
+    lower_guard_entry(&guard, 1);
+    return status;
+}
+
+static void measure_charge()
+{
+    CHECK(guard_cache_entry_init(&cache, 0, 16, 1) == 0);
+    CHECK(put_key(0) == 0);
+    charge = atomic_size_load(&cache.bytes);
+    CHECK(charge != 0);
+    guard_cache_entry_destroy(&cache);
+}
+
+static void test_budget_is_shared()
+{
+    // Four entries fit, even though a sixteenth of the budget
+    // is smaller than a single one of them
+    CHECK(guard_cache_entry_init(&cache, 4 * charge, 64, 1) == 0);
+    for (uint64_t key = 0; key < 4; key++)
+    {
+        CHECK(put_key(key) == 0);
+    }
+    CHECK(guard_cache_entry_size(&cache) == 4);
+
+    for (uint64_t key = 4; key < 256; key++)
+    {
+        CHECK(put_key(key) == 0);
+        CHECK(atomic_size_load(&cache.bytes) <= 4 * charge);
+    }
+
+    size_t hits, misses, evictions;
+    guard_cache_entry_stats(&cache, &hits, &misses, &evictions);
+    CHECK(evictions == 252);
+    CHECK(guard_cache_entry_size(&cache) == 4);
+
+    guard_cache_entry_destroy(&cache);
+}
+
+static void test_tiny_budget()
+{
+    // Smaller than any entry: rejected, not treated as unlimited
+    CHECK(guard_cache_entry_init(&cache, 8, 64, 1) == 0);
+    CHECK(put_key(1) == -1);
+    CHECK(guard_cache_entry_size(&cache) == 0);
+    CHECK(atomic_size_load(&cache.bytes) == 0);
+    guard_cache_entry_destroy(&cache);
+}
+
+static void *churn(void *arg)
+{
+    const uint64_t base = (uint64_t)(uintptr_t)arg * OPS;
+    for (uint64_t i = 0; i < OPS; i++)
+    {
+        CHECK(put_key(base + i % 512) == 0);
+        CHECK(atomic_size_load(&cache.bytes) <= 32 * charge);
+
+        heap_guard_entry_t *hit = guard_cache_entry_get(&cache, base + (i * 7) % 512);
+        if (hit != NULL)
+        {
+            CHECK((uint64_t)*hit->ptr == base + (i * 7) % 512);
+            lower_guard_entry(&hit, 1);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_budget()
+{
+    CHECK(guard_cache_entry_init(&cache, 32 * charge, 1024, 1) == 0);
+
+    pthread_t threads[THREADS];
+    for (uintptr_t i = 0; i < THREADS; i++)
+    {
+        CHECK(pthread_create(&threads[i], NULL, churn, (void *)i) == 0);
+    }
+    for (size_t i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    CHECK(guard_cache_entry_size(&cache) <= 32);
+    CHECK(atomic_size_load(&cache.bytes) == guard_cache_entry_size(&cache) * charge);
+
+    guard_cache_entry_destroy(&cache);
+    CHECK(atomic_size_load(&cache.bytes) == 0);
+}
+
+int main()
+{
+    measure_charge();
+    test_budget_is_shared();
+    test_tiny_budget();
+    test_concurrent_budget();
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+
+DEFINE_HEAP_GUARD(long, entry, 64);
+DEFINE_HEAP_GUARD_MAP(long, entry);
+
+#define KEYS 512
+#define READERS 3
+#define WRITERS 3
+#define OPS 50000
+
+static guard_map_entry_t map;
+static atomic_size_t mismatches;
+
+static int insert_key(const uint64_t key)
+{
+    heap_guard_entry_t *guard = heap_entry_alloc(1, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    *guard->ptr = (long)key;
+    const int status = guard_map_entry_insert(&map, key, guard);
+    lower_guard_entry(&guard, 1);
+    return status;
+}
+
+static size_t slot_count()
+{
+    return atomic_load(&map.table)->mask + 1;
+}
+
+static void test_churn_clears_tombstones()
+{
+    CHECK(guard_map_entry_init(&map, KEYS, 1) == 0);
+    const size_t slots = slot_count();
+
+    // Every key is removed right after being inserted, so without
+    // rebuilds each of them would leave a tombstone behind
+    for (uint64_t key = 0; key < 64 * slots; key++)
+    {
+        CHECK(insert_key(key) == 0);
+        CHECK(guard_map_entry_remove(&map, key) == 0);
+        CHECK(atomic_size_load(&map.tombstones) < slots / 4);
+    }
+
+    CHECK(guard_map_entry_count(&map) == 0);
+    CHECK(slot_count() == slots);
+
+    // A miss stops at the first empty slot of a short chain
+    CHECK(guard_map_entry_get(&map, 1ull << 40) == NULL);
+
+    for (uint64_t key = 0; key < KEYS; key++)
+    {
+        CHECK(insert_key(key) == 0);
+    }
+
+    CHECK(insert_key(7) == -1);
+    for (uint64_t key = 0; key < KEYS; key++)
+    {
+        heap_guard_entry_t *guard = guard_map_entry_get(&map, key);
+        CHECK(guard != NULL && *guard->ptr == (long)key);
+        lower_guard_entry(&guard, 1);
+    }
+
+    guard_map_entry_destroy(&map);
+    CHECK(heap_entry_usage() == 0);
+}
+
+static void *reader(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < OPS; i++)
+    {
+        const uint64_t key = i % KEYS;
+        heap_guard_entry_t *guard = guard_map_entry_get(&map, key);
+        if (guard != NULL)
+        {
+            if (*guard->ptr != (long)key)
+            {
+                atomic_size_fetch_add(&mismatches, 1);
+            }
+
+            lower_guard_entry(&guard, 1);
+        }
+    }
+
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    const size_t base = (size_t)arg;
+    for (size_t i = 0; i < OPS; i++)
+    {
+        const uint64_t key = (i * 13 + base) % KEYS;
+        if (i & 1)
+        {
+            guard_map_entry_remove(&map, key);
+        }
+        else
+        {
+            insert_key(key);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_concurrent_churn()
+{
+    CHECK(guard_map_entry_init(&map, KEYS, 1) == 0);
+    atomic_size_init(&mismatches, 0);
+
+    pthread_t threads[READERS + WRITERS];
+    for (size_t i = 0; i < READERS; i++)
+    {
+        CHECK(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+    }
+
+    for (size_t i = 0; i < WRITERS; i++)
+    {
+        CHECK(pthread_create(&threads[READERS + i], NULL, writer, (void *)i) == 0);
+    }
+
+    for (size_t i = 0; i < READERS + WRITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Readers never saw a node for another key, rebuilds included
+    CHECK(atomic_size_load(&mismatches) == 0);
+    CHECK(atomic_size_load(&map.tombstones) < slot_count() / 4);
+
+    // Every key present is found exactly where get() looks
+    size_t found = 0;
+    for (uint64_t key = 0; key < KEYS; key++)
+    {
+        heap_guard_entry_t *guard = guard_map_entry_get(&map, key);
+        if (guard != NULL)
+        {
+            found++;
+            lower_guard_entry(&guard, 1);
+        }
+    }
+
+    CHECK(found == guard_map_entry_count(&map));
+    guard_map_entry_destroy(&map);
+    CHECK(heap_entry_usage() == 0);
+}
+
+int main()
+{
+    test_churn_clears_tombstones();
+    test_concurrent_churn();
+    return 0;
+}
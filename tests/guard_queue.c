@@ -0,0 +1,167 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+DEFINE_HEAP_GUARD(long, job, 64);
+DEFINE_HEAP_GUARD_QUEUE(long, job);
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define PER_PRODUCER 50000
+#define TOTAL (PRODUCERS * PER_PRODUCER)
+#define BATCH 8
+
+static guard_queue_job_t queue;
+static atomic_uchar seen[TOTAL];
+static atomic_size_t consumed;
+
+static heap_guard_job_t *make_job(const long value)
+{
+    heap_guard_job_t *guard = heap_job_alloc(0, 1, NULL, NULL);
+    CHECK(guard != NULL);
+    *guard->ptr = value;
+    return guard;
+}
+
+static void *produce(void *arg)
+{
+    const long base = (long)(uintptr_t)arg * PER_PRODUCER;
+    heap_guard_job_t *batch[BATCH];
+
+    for (long i = 0; i < PER_PRODUCER;)
+    {
+        if (i % 64 == 0)
+        {
+            // Still shared with the producer when pushed, so the
+            // queue has to promote it before a consumer lowers it
+            heap_guard_job_t *guard = make_job(base + i);
+            raise_guard_job(guard);
+            while (guard_queue_job_push(&queue, guard) != 0)
+            {
+                sched_yield();
+            }
+            lower_guard_job(&guard, 1);
+            i++;
+            continue;
+        }
+
+        size_t count = 0;
+        while (count < BATCH && i + (long)count < PER_PRODUCER && (i + (long)count) % 64 != 0)
+        {
+            batch[count] = make_job(base + i + (long)count);
+            count++;
+        }
+
+        size_t pushed = 0;
+        while (pushed < count)
+        {
+            const size_t taken = guard_queue_job_push_batch(&queue, batch + pushed, count - pushed);
+            if (taken == 0)
+            {
+                sched_yield();
+            }
+            pushed += taken;
+        }
+        i += (long)count;
+    }
+
+    return NULL;
+}
+
+static void consume_one(heap_guard_job_t *guard)
+{
+    const long value = *guard->ptr;
+    CHECK(value >= 0 && value < TOTAL);
+    CHECK(atomic_exchange(&seen[value], 1) == 0);
+    lower_guard_job(&guard, 1);
+    atomic_size_fetch_add(&consumed, 1);
+}
+
+static void *consume(void *arg)
+{
+    const int batched = (int)(uintptr_t)arg & 1;
+    heap_guard_job_t *batch[BATCH];
+
+    while (atomic_size_load(&consumed) < TOTAL)
+    {
+        if (batched)
+        {
+            const size_t count = guard_queue_job_pop_batch(&queue, batch, BATCH);
+            for (size_t i = 0; i < count; i++)
+            {
+                consume_one(batch[i]);
+            }
+            if (count == 0)
+            {
+                sched_yield();
+            }
+            continue;
+        }
+
+        heap_guard_job_t *guard = guard_queue_job_pop(&queue);
+        if (guard == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+        consume_one(guard);
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    // Smaller than the traffic, so producers keep hitting a full queue
+    CHECK(guard_queue_job_init(&queue, 256, 1) == 0);
+    atomic_size_init(&consumed, 0);
+
+    pthread_t producers[PRODUCERS];
+    pthread_t consumers[CONSUMERS];
+    for (uintptr_t i = 0; i < CONSUMERS; i++)
+    {
+        CHECK(pthread_create(&consumers[i], NULL, consume, (void *)i) == 0);
+    }
+    for (uintptr_t i = 0; i < PRODUCERS; i++)
+    {
+        CHECK(pthread_create(&producers[i], NULL, produce, (void *)i) == 0);
+    }
+
+    for (size_t i = 0; i < PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (size_t i = 0; i < CONSUMERS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    // Every job came out exactly once and nothing is left behind
+    CHECK(atomic_size_load(&consumed) == TOTAL);
+    for (size_t i = 0; i < TOTAL; i++)
+    {
+        CHECK(atomic_load(&seen[i]) == 1);
+    }
+    CHECK(guard_queue_job_pop(&queue) == NULL);
+
+    guard_queue_job_destroy(&queue);
+
+    // A snapshot writes every live guard, there should be none
+    FILE *sink = tmpfile();
+    CHECK(sink != NULL);
+    CHECK(heap_job_snapshot_write(fileno(sink)) == 0);
+    fclose(sink);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <pthread.h>
+
+DEFINE_HEAP_GUARD(long, item, 64);
+
+// Too wide to sit inline in the guard, so it comes from the slab
+typedef struct wide_t
+{
+    long values[8];
+} wide_t;
+
+DEFINE_HEAP_GUARD(wide_t, local, 64);
+
+#define LENGTH 16
+#define READERS 4
+#define WRITERS 2
+#define ROUNDS 20000
+#define POISON (-1L)
+
+static heap_guard_item_t *shared;
+static atomic_int stop;
+static atomic_size_t replaced;
+static atomic_size_t released;
+static atomic_size_t reads;
+
+// Poisons the payload before freeing it, so a reader that still
+// walks it after reclamation fails even without a sanitizer
+static void release_payload(void *ptr, const size_t bytes, void *ctx)
+{
+    (void)ctx;
+    long *values = (long *)ptr;
+    for (size_t i = 0; i < bytes / sizeof(long); i++)
+    {
+        values[i] = POISON;
+    }
+
+    free(ptr);
+    atomic_size_fetch_add(&released, 1);
+}
+
+static const heap_guard_releaser_t releaser = { release_payload, NULL };
+
+static void *read_loop(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&stop))
+    {
+        heap_guard_epoch_enter();
+        size_t length = 0;
+        const long *values = deref_guard_item(shared, &length);
+
+        // Every payload is one version throughout its first LENGTH elements
+        CHECK(values != NULL && length >= LENGTH);
+        const long version = values[0];
+        CHECK(version != POISON);
+        for (size_t i = 1; i < LENGTH; i++)
+        {
+            CHECK(values[i] == version);
+        }
+        heap_guard_epoch_exit();
+
+        atomic_size_fetch_add(&reads, 1);
+    }
+
+    return NULL;
+}
+
+static void *write_loop(void *arg)
+{
+    const long writer = (long)(uintptr_t)arg;
+    for (long round = 0; round < ROUNDS; round++)
+    {
+        const long version = round * WRITERS + writer + 1;
+        const size_t length = LENGTH + (size_t)(round % 4);
+        long *values = (long *)malloc(length * sizeof(long));
+        CHECK(values != NULL);
+        for (size_t i = 0; i < length; i++)
+        {
+            values[i] = version;
+        }
+
+        CHECK(replace_payload_item(shared, values, length, &releaser, 1) == 0);
+        atomic_size_fetch_add(&replaced, 1);
+
+        // Copies whatever is current, readers may still hold it
+        if (writer == 0 && round % 128 == 0)
+        {
+            size_t current = 0;
+            heap_guard_epoch_enter();
+            deref_guard_item(shared, &current);
+            heap_guard_epoch_exit();
+            CHECK(extend_guard_rcu_item(shared, current + 1, 1) == 0);
+        }
+    }
+
+    return NULL;
+}
+
+// A pool that never takes its lock can't have slots handed back
+// from another thread, its pool payloads stay where they are
+static void test_unlocked_pool()
+{
+    heap_guard_local_t *guard = heap_local_alloc(0, 0, NULL, NULL);
+    CHECK(guard != NULL);
+    CHECK(guard->__origin == HEAP_GUARD_ORIGIN_POOL);
+    wide_t *pooled = guard->ptr;
+
+    wide_t *values = (wide_t *)malloc(sizeof(wide_t));
+    CHECK(values != NULL);
+    CHECK(replace_payload_local(guard, values, 1, &releaser, 0) == -1);
+    CHECK(extend_guard_rcu_local(guard, 2, 0) == -1);
+    CHECK(guard->ptr == pooled && guard->allocated == 1);
+
+    // Once the type takes its lock, the same guard can be replaced
+    heap_guard_local_t *locked = heap_local_alloc(1, 1, NULL, NULL);
+    CHECK(locked != NULL);
+    CHECK(replace_payload_local(guard, values, 1, &releaser, 1) == 0);
+    CHECK(guard->ptr == values);
+
+    lower_guard_local(&locked, 1);
+    lower_guard_local(&guard, 1);
+    heap_guard_epoch_synchronize();
+    CHECK(atomic_size_load(&released) == 1);
+    atomic_size_store(&released, 0);
+}
+
+int main()
+{
+    test_unlocked_pool();
+
+    shared = heap_item_alloc_array(LENGTH, 1, 1, NULL);
+    CHECK(shared != NULL);
+    for (size_t i = 0; i < LENGTH; i++)
+    {
+        shared->ptr[i] = 0;
+    }
+
+    pthread_t readers[READERS];
+    pthread_t writers[WRITERS];
+    for (size_t i = 0; i < READERS; i++)
+    {
+        CHECK(pthread_create(&readers[i], NULL, read_loop, NULL) == 0);
+    }
+    for (uintptr_t i = 0; i < WRITERS; i++)
+    {
+        CHECK(pthread_create(&writers[i], NULL, write_loop, (void *)i) == 0);
+    }
+
+    for (size_t i = 0; i < WRITERS; i++)
+    {
+        pthread_join(writers[i], NULL);
+    }
+    atomic_store(&stop, 1);
+    for (size_t i = 0; i < READERS; i++)
+    {
+        pthread_join(readers[i], NULL);
+    }
+
+    CHECK(atomic_size_load(&reads) > 0);
+    CHECK(atomic_size_load(&replaced) == WRITERS * ROUNDS);
+
+    // Each adopted payload goes back through the releaser exactly
+    // once: the retired ones after a grace period, the last one on
+    // the final lower
+    lower_guard_item(&shared, 1);
+    heap_guard_epoch_synchronize();
+    CHECK(atomic_size_load(&released) == WRITERS * ROUNDS);
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#ifndef FLUENT_LIBC_HEAP_GUARD_TEST_H
+#define FLUENT_LIBC_HEAP_GUARD_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks stay active in every build type, unlike assert()
+#define CHECK(cond)                                         \
+    do                                                      \
+    {                                                       \
+        if (!(cond))                                        \
+        {                                                   \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                        \
+        }                                                   \
+    } while (0)
+
+#endif //FLUENT_LIBC_HEAP_GUARD_TEST_H
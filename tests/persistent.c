@@ -0,0 +1,106 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <unistd.h>
+
+typedef struct record_t
+{
+    uint64_t id;
+    heap_guard_handle_t next;
+} record_t;
+
+DEFINE_HEAP_GUARD_PERSISTENT(record_t, record);
+DEFINE_HEAP_GUARD_PERSISTENT(uint32_t, narrow);
+
+#define RECORDS 100
+#define CAPACITY 128
+
+static uint64_t live_records()
+{
+    return atomic_load(&__fluent_libc_hg_region_header(&__fluent_libc_hg_record_persist_region)->live);
+}
+
+// Builds RECORDS records linked from the root, ids counting down
+static void build(void)
+{
+    heap_guard_handle_t head = HEAP_GUARD_NULL_HANDLE;
+    for (uint64_t id = 1; id <= RECORDS; id++)
+    {
+        const heap_guard_handle_t handle = heap_record_persist_alloc();
+        CHECK(handle != HEAP_GUARD_NULL_HANDLE);
+        record_t *record = heap_record_persist_resolve(handle);
+        record->id = id;
+        record->next = head;
+        head = handle;
+    }
+
+    heap_record_persist_set_root(head);
+
+    // A second holder of the root, it has to survive the restart too
+    heap_record_persist_raise(head);
+}
+
+static void check_chain(void)
+{
+    uint64_t expected = RECORDS;
+    for (heap_guard_handle_t handle = heap_record_persist_root(); handle != HEAP_GUARD_NULL_HANDLE;)
+    {
+        const record_t *record = heap_record_persist_resolve(handle);
+        CHECK(record->id == expected);
+        expected--;
+        handle = record->next;
+    }
+
+    CHECK(expected == 0);
+}
+
+int main()
+{
+    char path[] = "/tmp/heap_guard_persistent.XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    // Fresh file: formatted, then filled and flushed
+    CHECK(heap_record_persist_open(path, CAPACITY) == 0);
+    build();
+    CHECK(live_records() == RECORDS);
+    CHECK(heap_record_persist_sync(0) == 0);
+    heap_record_persist_close();
+
+    // Warm restart: same graph, same counts, capacity from the file
+    CHECK(heap_record_persist_open(path, 1) == 1);
+    CHECK(live_records() == RECORDS);
+    check_chain();
+
+    heap_guard_handle_t root = heap_record_persist_root();
+    heap_record_persist_lower(&root);
+    CHECK(root != HEAP_GUARD_NULL_HANDLE);
+    heap_record_persist_lower(&root);
+    CHECK(root == HEAP_GUARD_NULL_HANDLE);
+    CHECK(live_records() == RECORDS - 1);
+
+    // The released slot is recycled, and the free list survives a restart too
+    heap_record_persist_close();
+    CHECK(heap_record_persist_open(path, CAPACITY) == 1);
+    CHECK(live_records() == RECORDS - 1);
+    const heap_guard_handle_t reused = heap_record_persist_alloc();
+    CHECK(reused == heap_record_persist_root());
+    heap_record_persist_close();
+
+    // A region formatted for another payload size is refused
+    CHECK(heap_narrow_persist_open(path, CAPACITY) == -1);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+typedef struct
+{
+    long value[8];
+} near_t;
+
+DEFINE_HEAP_GUARD(near_t, near, 64);
+DEFINE_HEAP_GUARD(near_t, owned, 64);
+
+// pressure_trim_pool.c
+size_t far_fill(size_t count);
+size_t far_footprint();
+
+#define COUNT 2000
+
+static size_t near_fill()
+{
+    static heap_guard_near_t *guards[COUNT];
+    for (int i = 0; i < COUNT; i++)
+    {
+        guards[i] = heap_near_alloc(0, 1, NULL, NULL);
+        CHECK(guards[i] != NULL);
+    }
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        lower_guard_near(&guards[i], 1);
+    }
+
+    return heap_near_footprint();
+}
+
+static size_t owned_fill()
+{
+    static heap_guard_owned_t *guards[COUNT];
+    for (int i = 0; i < COUNT; i++)
+    {
+        guards[i] = heap_owned_alloc(0, 0, NULL, NULL);
+        CHECK(guards[i] != NULL);
+    }
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        lower_guard_owned(&guards[i], 0);
+    }
+
+    return heap_owned_footprint();
+}
+
+static size_t idle_trim()
+{
+    return 0;
+}
+
+// The registry refuses types past its cap instead of dropping
+// them quietly, and takes them again once there is room
+static void test_registry_cap()
+{
+    size_t added = 0;
+    while (__fluent_libc_hg_pressure_register(idle_trim) == 0)
+    {
+        added++;
+        CHECK(added <= HEAP_GUARD_PRESSURE_MAX_POOLS);
+    }
+
+    // near and far already hold a slot each
+    CHECK(added == HEAP_GUARD_PRESSURE_MAX_POOLS - 2);
+    __fluent_libc_hg_pressure_unregister(idle_trim);
+    CHECK(__fluent_libc_hg_pressure_register(idle_trim) == 0);
+
+    for (size_t i = 0; i < added; i++)
+    {
+        __fluent_libc_hg_pressure_unregister(idle_trim);
+    }
+    CHECK(__fluent_libc_hg_pressure_state()->trim_count == 2);
+}
+
+int main()
+{
+    const size_t near = near_fill();
+    const size_t far = far_fill(COUNT);
+    const size_t owned = owned_fill();
+    CHECK(near > 0 && far > 0 && owned > 0);
+
+    // Both locked pools are trimmed, whichever file defines them
+    CHECK(heap_guard_trim_all() == near + far);
+    CHECK(heap_near_footprint() == 0);
+    CHECK(far_footprint() == 0);
+
+    // A pool never used with insertion_concurrent stays out of the
+    // registry and only shrinks when its owner asks
+    CHECK(heap_owned_footprint() == owned);
+    CHECK(heap_owned_trim() == owned);
+
+    test_registry_cap();
+    return 0;
+}
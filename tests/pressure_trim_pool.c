@@ -0,0 +1,42 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+// A pool defined in a second translation unit, which must reach
+// the same pressure registry as the ones in pressure_trim.c
+#include "heap_guard.h"
+
+typedef struct
+{
+    long value[8];
+} far_t;
+
+DEFINE_HEAP_GUARD(far_t, far, 64);
+
+size_t far_fill(const size_t count)
+{
+    heap_guard_far_t **guards = malloc(count * sizeof(*guards));
+    for (size_t i = 0; i < count; i++)
+    {
+        guards[i] = heap_far_alloc(0, 1, NULL, NULL);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        lower_guard_far(&guards[i], 1);
+    }
+
+    free(guards);
+    return heap_far_footprint();
+}
+
+size_t far_footprint()
+{
+    return heap_far_footprint();
+}
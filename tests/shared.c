@@ -0,0 +1,148 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define WORKERS 4
+#define ITERATIONS 10000
+
+typedef struct row_t
+{
+    _Atomic uint64_t hits;
+    heap_guard_handle_t rows[WORKERS]; // one per worker, allocated on its side
+} row_t;
+
+DEFINE_HEAP_GUARD_SHARED(row_t, row);
+
+static uint64_t live_rows()
+{
+    return atomic_load(&__fluent_libc_hg_region_header(&__fluent_libc_hg_row_shared_region)->live);
+}
+
+// Hammers the root's count and payload from another process,
+// then hands a row of its own back through the root
+static void work(const size_t worker)
+{
+    const heap_guard_handle_t root = heap_row_shared_root();
+    CHECK(root != HEAP_GUARD_NULL_HANDLE);
+
+    for (size_t i = 0; i < ITERATIONS; i++)
+    {
+        heap_guard_handle_t held = root;
+        heap_row_shared_raise(held);
+        atomic_fetch_add(&heap_row_shared_resolve(held)->hits, 1);
+        heap_row_shared_lower(&held);
+        CHECK(held == root);
+    }
+
+    const heap_guard_handle_t own = heap_row_shared_alloc();
+    CHECK(own != HEAP_GUARD_NULL_HANDLE);
+    atomic_store(&heap_row_shared_resolve(own)->hits, 1000 + worker);
+    heap_row_shared_resolve(root)->rows[worker] = own;
+}
+
+static void run_workers(const char *name)
+{
+    pid_t pids[WORKERS];
+    for (size_t w = 0; w < WORKERS; w++)
+    {
+        pids[w] = fork();
+        CHECK(pids[w] >= 0);
+        if (pids[w] != 0)
+        {
+            continue;
+        }
+
+        // Drop the inherited mapping and join the heap from scratch,
+        // it may land at another address
+        if (name != NULL)
+        {
+            heap_row_shared_close();
+            CHECK(heap_row_shared_open(name) == 0);
+        }
+        else
+        {
+            const int fd = dup(__fluent_libc_hg_row_shared_region.fd);
+            CHECK(fd >= 0);
+            heap_row_shared_close();
+            CHECK(heap_row_shared_attach(fd) == 0);
+        }
+
+        work(w);
+        heap_row_shared_close();
+        _exit(0);
+    }
+
+    for (size_t w = 0; w < WORKERS; w++)
+    {
+        int status = 0;
+        CHECK(waitpid(pids[w], &status, 0) == pids[w]);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+static void check_and_release()
+{
+    heap_guard_handle_t root = heap_row_shared_root();
+    row_t *shared = heap_row_shared_resolve(root);
+    CHECK(atomic_load(&shared->hits) == WORKERS * ITERATIONS);
+    CHECK(live_rows() == 1 + WORKERS);
+
+    for (size_t w = 0; w < WORKERS; w++)
+    {
+        CHECK(shared->rows[w] != HEAP_GUARD_NULL_HANDLE);
+        CHECK(atomic_load(&heap_row_shared_resolve(shared->rows[w])->hits) == 1000 + w);
+        heap_row_shared_lower(&shared->rows[w]);
+        CHECK(shared->rows[w] == HEAP_GUARD_NULL_HANDLE);
+    }
+
+    // Every worker's raise was matched, the root is back to one holder
+    heap_row_shared_lower(&root);
+    CHECK(root == HEAP_GUARD_NULL_HANDLE);
+    CHECK(live_rows() == 0);
+}
+
+static void setup()
+{
+    const heap_guard_handle_t root = heap_row_shared_alloc();
+    CHECK(root != HEAP_GUARD_NULL_HANDLE);
+    row_t *shared = heap_row_shared_resolve(root);
+    atomic_init(&shared->hits, 0);
+    for (size_t w = 0; w < WORKERS; w++)
+    {
+        shared->rows[w] = HEAP_GUARD_NULL_HANDLE;
+    }
+    heap_row_shared_set_root(root);
+}
+
+int main()
+{
+    // Anonymous object, reached through an inherited descriptor
+    CHECK(heap_row_shared_create(NULL, 64) == 0);
+    setup();
+    run_workers(NULL);
+    check_and_release();
+    heap_row_shared_close();
+
+    // Named object, joined by name
+    char name[64];
+    snprintf(name, sizeof(name), "/heap_guard_test.%ld", (long)getpid());
+    CHECK(heap_row_shared_create(name, 64) == 0);
+    setup();
+    run_workers(name);
+    check_and_release();
+    heap_row_shared_close();
+    shm_unlink(name);
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+DEFINE_HEAP_GUARD(int, int, 64);
+// Larger than HEAP_GUARD_INLINE_MAX, so payloads use their own slab
+typedef struct
+{
+    double value;
+    double pad[3];
+} wide_t;
+
+DEFINE_HEAP_GUARD(wide_t, wide, 16);
+
+#define MANY 5000
+
+static void test_recycles_slots()
+{
+    heap_guard_int_t *guard = heap_int_alloc(0, 0, NULL, NULL);
+    CHECK(guard != NULL && guard->ptr != NULL);
+    int *slot = guard->ptr;
+    heap_guard_int_t *header = guard;
+
+    lower_guard_int(&guard, 0);
+    CHECK(guard == NULL);
+
+    // The per-block free lists hand back the last freed slot first
+    guard = heap_int_alloc(0, 0, NULL, NULL);
+    CHECK(guard != NULL);
+    CHECK(guard->ptr == slot);
+    CHECK(guard == header);
+    lower_guard_int(&guard, 0);
+}
+
+static void test_external_payloads_stay_out()
+{
+    int external = 7;
+    heap_guard_int_t *guard = heap_int_alloc(0, 0, NULL, &external);
+    CHECK(guard != NULL && guard->ptr == &external);
+    lower_guard_int(&guard, 0);
+
+    // A default_ptr payload must never come back out of the pool
+    for (int i = 0; i < 8; i++)
+    {
+        heap_guard_int_t *other = heap_int_alloc(0, 0, NULL, NULL);
+        CHECK(other != NULL && other->ptr != &external);
+        lower_guard_int(&other, 0);
+    }
+}
+
+static void test_spans_blocks()
+{
+    static heap_guard_wide_t *guards[MANY];
+
+    for (int i = 0; i < MANY; i++)
+    {
+        guards[i] = heap_wide_alloc(0, 0, NULL, NULL);
+        CHECK(guards[i] != NULL);
+        CHECK(((uintptr_t)guards[i]->ptr & (_Alignof(wide_t) - 1)) == 0);
+        guards[i]->ptr->value = (double)i;
+    }
+
+    // Slots of one slab never overlap, even across blocks
+    for (int i = 0; i < MANY; i++)
+    {
+        CHECK(guards[i]->ptr->value == (double)i);
+    }
+
+    CHECK(__fluent_libc_hg_wide_val_slab.block_count > 1);
+    const size_t blocks = __fluent_libc_hg_wide_val_slab.block_count;
+
+    for (int i = 0; i < MANY; i++)
+    {
+        lower_guard_wide(&guards[i], 0);
+    }
+
+    // A second round reuses the blocks instead of growing
+    for (int i = 0; i < MANY; i++)
+    {
+        guards[i] = heap_wide_alloc(0, 0, NULL, NULL);
+        CHECK(guards[i] != NULL);
+    }
+
+    CHECK(__fluent_libc_hg_wide_val_slab.block_count == blocks);
+
+    for (int i = 0; i < MANY; i++)
+    {
+        lower_guard_wide(&guards[i], 0);
+    }
+}
+
+int main()
+{
+    test_recycles_slots();
+    test_external_payloads_stay_out();
+    test_spans_blocks();
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * This code is distributed under the terms of the GNU General Public License.
+ * For more information, please refer to the LICENSE file in the root directory.
+ * -------------------------------------------------
+ * Copyright (C) 2025 Rodrigo R.
+ * This program comes with ABSOLUTELY NO WARRANTY; for details type show w'.
+ * This is free software, and you are welcome to redistribute it
+ * under certain conditions; type show c' for details.
+*/
+
+#include "heap_guard.h"
+#include "heap_guard_test.h"
+
+#include <unistd.h>
+
+DEFINE_HEAP_GUARD(long, item, 64);
+
+#define ITEMS 3
+
+static heap_guard_item_t *restored[ITEMS];
+static size_t restored_count;
+static size_t destroyed;
+
+static void destroy_item(const heap_guard_item_t *guard, const int is_exit)
+{
+    (void)guard;
+    (void)is_exit;
+    destroyed++;
+}
+
+static void collect(heap_guard_item_t *guard, void *ctx)
+{
+    (void)ctx;
+    CHECK(restored_count < ITEMS);
+    restored[restored_count++] = guard;
+}
+
+static size_t refs(heap_guard_item_t *guard)
+{
+    return guard->concurrent ? atomic_size_load(&guard->concurrent_ref) : guard->ref_count;
+}
+
+static long live_guards()
+{
+    FILE *sink = tmpfile();
+    CHECK(sink != NULL);
+    const long count = heap_item_snapshot_write(fileno(sink));
+    fclose(sink);
+    return count;
+}
+
+// Guard i holds an array of i + 1 longs, each (i + 1) * 100 + j
+static int dump(FILE *file)
+{
+    heap_guard_item_t *items[ITEMS];
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        items[i] = heap_item_alloc_array(i + 1, i == 1, 0, NULL);
+        CHECK(items[i] != NULL);
+        for (size_t j = 0; j <= i; j++)
+        {
+            items[i]->ptr[j] = (long)((i + 1) * 100 + j);
+        }
+    }
+
+    // Counts held in this process don't travel with the stream
+    raise_guard_item(items[2]);
+    raise_guard_item(items[2]);
+
+    const long written = heap_item_snapshot_write(fileno(file));
+
+    lower_guard_item(&items[2], 0);
+    lower_guard_item(&items[2], 0);
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        lower_guard_item(&items[i], 0);
+    }
+
+    CHECK(live_guards() == 0);
+    return written == ITEMS;
+}
+
+static void test_round_trip()
+{
+    FILE *file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(dump(file));
+
+    CHECK(lseek(fileno(file), 0, SEEK_SET) == 0);
+    restored_count = 0;
+    CHECK(heap_item_snapshot_read(fileno(file), 0, destroy_item, collect, NULL) == ITEMS);
+    CHECK(restored_count == ITEMS);
+
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        heap_guard_item_t *guard = restored[i];
+        const size_t length = guard->allocated;
+        CHECK(length >= 1 && length <= ITEMS);
+        CHECK(guard->concurrent == (length == 2));
+        CHECK(refs(guard) == 1);
+        for (size_t j = 0; j < length; j++)
+        {
+            CHECK(guard->ptr[j] == (long)(length * 100 + j));
+        }
+    }
+
+    // One lower each releases every restored guard
+    destroyed = 0;
+    for (size_t i = 0; i < ITEMS; i++)
+    {
+        lower_guard_item(&restored[i], 0);
+        CHECK(restored[i] == NULL);
+    }
+    CHECK(destroyed == ITEMS);
+    CHECK(live_guards() == 0);
+
+    fclose(file);
+}
+
+static void test_corrupt_stream()
+{
+    FILE *file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(dump(file));
+
+    // Flip the last payload byte before the trailer
+    const off_t end = lseek(fileno(file), 0, SEEK_END);
+    const off_t at = end - (off_t)(sizeof(__fluent_libc_hg_snapshot_record_t) + sizeof(uint64_t)) - 1;
+    unsigned char byte;
+    CHECK(pread(fileno(file), &byte, 1, at) == 1);
+    byte ^= 0xFF;
+    CHECK(pwrite(fileno(file), &byte, 1, at) == 1);
+
+    CHECK(lseek(fileno(file), 0, SEEK_SET) == 0);
+    restored_count = 0;
+    destroyed = 0;
+    CHECK(heap_item_snapshot_read(fileno(file), 0, destroy_item, collect, NULL) == -1);
+    CHECK(restored_count == 0);
+    CHECK(destroyed == 0);
+    CHECK(live_guards() == 0);
+
+    fclose(file);
+}
+
+int main()
+{
+    test_round_trip();
+    test_corrupt_stream();
+    return 0;
+}